@@ -0,0 +1 @@
+../arena.hh
\ No newline at end of file
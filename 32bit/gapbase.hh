@@ -0,0 +1 @@
+../gapbase.hh
\ No newline at end of file
@@ -0,0 +1 @@
+../intern.hh
\ No newline at end of file
@@ -0,0 +1 @@
+../journal.hh
\ No newline at end of file
@@ -0,0 +1 @@
+../lazyfile.hh
\ No newline at end of file
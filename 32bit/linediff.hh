@@ -0,0 +1 @@
+../linediff.hh
\ No newline at end of file
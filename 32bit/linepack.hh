@@ -0,0 +1 @@
+../linepack.hh
\ No newline at end of file
@@ -0,0 +1 @@
+../linescan.hh
\ No newline at end of file
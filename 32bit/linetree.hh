@@ -0,0 +1 @@
+../linetree.hh
\ No newline at end of file
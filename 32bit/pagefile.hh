@@ -0,0 +1 @@
+../pagefile.hh
\ No newline at end of file
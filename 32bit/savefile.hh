@@ -0,0 +1 @@
+../savefile.hh
\ No newline at end of file
@@ -0,0 +1 @@
+../tabcols.hh
\ No newline at end of file
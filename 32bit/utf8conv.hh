@@ -0,0 +1 @@
+../utf8conv.hh
\ No newline at end of file
@@ -0,0 +1 @@
+../vec_sg.hh
\ No newline at end of file
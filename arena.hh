@@ -0,0 +1,230 @@
+/* Ad-hoc programming editor for DOSBox -- (C) 2011-03-08 Joel Yliluoma */
+#ifndef bqtArenaHH
+#define bqtArenaHH
+
+/* A size-class allocator for the contents of one editor buffer.
+ *
+ * Small requests are rounded up to the nearest size class
+ * (16, 24, 32, 48, 64, 96, ... bytes) and carved out of big chunks
+ * that are obtained from malloc. Freed blocks are kept on a free list
+ * per size class for reuse, never given back to malloc one at a time.
+ * Requests larger than MaxBlock bytes get their own malloc,
+ * but are still tracked by the arena.
+ *
+ * The caller must tell Deallocate() the same size that it gave to
+ * Allocate(). The vectors do that, because they know their capacity.
+ *
+ * ReleaseAll() gives everything back to malloc in one go.
+ * Whoever calls it must make sure that nothing that was allocated
+ * from the arena is used, or freed, afterwards.
+ *
+ * This exists mostly for the DJGPP build, where the DPMI heap
+ * is slow and fragments easily with hundreds of thousands of lines.
+ */
+
+#include <stdlib.h>
+
+class ArenaType
+{
+public:
+  #ifdef __BORLANDC__
+    enum { ChunkSize = 8192 };
+  #else
+    enum { ChunkSize = 65536 };
+  #endif
+    enum { MinBlock   = 16,
+           MaxBlock   = ChunkSize / 8,
+           MaxClasses = 24 };
+
+    /* Statistics, in bytes unless otherwise noted */
+    unsigned long num_chunks;      // Number of chunks obtained from malloc
+    unsigned long chunk_bytes;     // Total size of those chunks
+    unsigned long used_bytes;      // In small blocks currently handed out
+    unsigned long requested_bytes; // What the users asked for (small blocks)
+    unsigned long free_bytes;      // In small blocks on the free lists
+    unsigned long num_large;       // Number of large blocks
+    unsigned long large_bytes;     // Total size of the large blocks
+    unsigned long num_releases;    // Number of ReleaseAll() calls
+
+public:
+    ArenaType() : chunks(0), large(0), bump(0), bump_left(0)
+    {
+        ResetStats();
+        num_releases = 0;
+        for(unsigned c=0; c<MaxClasses; ++c) freelist[c] = 0;
+    }
+    ~ArenaType()
+    {
+        ReleaseAll();
+    }
+
+    void* Allocate(size_t bytes)
+    {
+        if(bytes > MaxBlock) return AllocateLarge(bytes);
+
+        unsigned c    = ClassOf(bytes);
+        size_t   size = ClassSize(c);
+        requested_bytes += bytes;
+        used_bytes      += size;
+
+        FreeBlock* f = freelist[c];
+        if(f)
+        {
+            freelist[c] = f->next;
+            free_bytes -= size;
+            return f;
+        }
+        if(bump_left < size && !NewChunk())
+        {
+            requested_bytes -= bytes;
+            used_bytes      -= size;
+            return 0;
+        }
+        void* result = bump;
+        bump      += size;
+        bump_left -= size;
+        return result;
+    }
+
+    void Deallocate(void* p, size_t bytes)
+    {
+        if(!p) return;
+        if(bytes > MaxBlock) { DeallocateLarge(p, bytes); return; }
+
+        unsigned c    = ClassOf(bytes);
+        size_t   size = ClassSize(c);
+        requested_bytes -= bytes;
+        used_bytes      -= size;
+        Push(p, c);
+    }
+
+    /* Frees every chunk and every large block at once. */
+    void ReleaseAll()
+    {
+        while(chunks)
+        {
+            Chunk* next = chunks->next;
+            free(chunks);
+            chunks = next;
+        }
+        while(large)
+        {
+            LargeBlock* next = large->next;
+            free(large);
+            large = next;
+        }
+        for(unsigned c=0; c<MaxClasses; ++c) freelist[c] = 0;
+        bump      = 0;
+        bump_left = 0;
+        ResetStats();
+        ++num_releases;
+    }
+
+    /* Bytes at the end of the newest chunk that have not been handed out yet */
+    unsigned long UnusedBytes() const
+    {
+        return bump_left;
+    }
+
+private:
+    // Not copyable
+    ArenaType(const ArenaType&);
+    void operator=(const ArenaType&);
+
+    struct FreeBlock  { FreeBlock* next; };
+    struct Chunk      { Chunk* next; };
+    struct LargeBlock { LargeBlock* prev; LargeBlock* next; };
+
+    /* Headers are padded to MinBlock bytes to keep the blocks aligned */
+    enum { ChunkHeader = (sizeof(Chunk)      + MinBlock-1) / MinBlock * MinBlock,
+           LargeHeader = (sizeof(LargeBlock) + MinBlock-1) / MinBlock * MinBlock };
+
+    /* Size classes alternate between 2^n and 1.5 * 2^n times MinBlock */
+    static size_t ClassSize(unsigned c)
+    {
+        return (size_t)(MinBlock + (c & 1) * (MinBlock/2)) << (c >> 1);
+    }
+    static unsigned ClassOf(size_t bytes)
+    {
+        unsigned c = 0;
+        while(ClassSize(c) < bytes) ++c;
+        return c;
+    }
+
+    void Push(void* p, unsigned c)
+    {
+        FreeBlock* f = (FreeBlock*)p;
+        f->next     = freelist[c];
+        freelist[c] = f;
+        free_bytes += ClassSize(c);
+    }
+
+    bool NewChunk()
+    {
+        Chunk* ch = (Chunk*) malloc(ChunkSize);
+        if(!ch) return false;
+
+        // Put the unused tail of the previous chunk to the free lists,
+        // in as few blocks as possible
+        for(unsigned c=MaxClasses; c-- > 0; )
+            while(ClassSize(c) <= MaxBlock && bump_left >= ClassSize(c))
+            {
+                Push(bump, c);
+                bump      += ClassSize(c);
+                bump_left -= ClassSize(c);
+            }
+
+        ch->next  = chunks;
+        chunks    = ch;
+        bump      = (char*)ch + ChunkHeader;
+        bump_left = ChunkSize - ChunkHeader;
+        num_chunks  += 1;
+        chunk_bytes += ChunkSize;
+        return true;
+    }
+
+    void* AllocateLarge(size_t bytes)
+    {
+        LargeBlock* b = (LargeBlock*) malloc(LargeHeader + bytes);
+        if(!b) return 0;
+        b->prev = 0;
+        b->next = large;
+        if(large) large->prev = b;
+        large = b;
+        num_large   += 1;
+        large_bytes += bytes;
+        return (char*)b + LargeHeader;
+    }
+    void DeallocateLarge(void* p, size_t bytes)
+    {
+        LargeBlock* b = (LargeBlock*) ((char*)p - LargeHeader);
+        if(b->prev) b->prev->next = b->next; else large = b->next;
+        if(b->next) b->next->prev = b->prev;
+        num_large   -= 1;
+        large_bytes -= bytes;
+        free(b);
+    }
+
+    void ResetStats()
+    {
+        num_chunks = chunk_bytes = 0;
+        used_bytes = requested_bytes = free_bytes = 0;
+        num_large  = large_bytes = 0;
+    }
+
+private:
+    FreeBlock*  freelist[MaxClasses];
+    Chunk*      chunks;
+    LargeBlock* large;
+    char*       bump;      // Next unused byte in the newest chunk
+    size_t      bump_left; // Number of unused bytes in the newest chunk
+};
+
+#ifdef LINE_ARENA
+/* The arena that holds the lines and the undo history
+ * of the editor buffer (defined in main.cc)
+ */
+extern ArenaType LineArena;
+#endif
+
+#endif
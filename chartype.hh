@@ -4,23 +4,59 @@
  */
 # define ATTRIBUTE_CODES_IN_VGA_ORDER
 #else
-/* Use 32-bit element types (xterm-256color) in the 32-bit code,
+/* Use 32-bit attributes (xterm-256color) on screen in the 32-bit code,
  * requires a patched DOSBox though
  */
 # define ATTRIBUTE_CODES_IN_ANSI_ORDER
 #endif
 
+/* #define GAP_BUFFER_LINES to store each line in a gap buffer
+ * instead of a flat vector. Makes typing in the middle of
+ * a long line cheaper, at the cost of slightly slower reading.
+ */
+
+/* Each cell in the buffer is 16 bits: the character code in the low byte,
+ * and the color attribute in the high byte. In the 16-bit code, the
+ * attribute is a VGA attribute. In the 32-bit code, it is the index of
+ * a style in StyleTable, which holds the actual xterm-256color attribute.
+ * The screen (and ComposeEditorChar) deals with ScreenCharType;
+ * ExpandEditorChar() converts a cell into one.
+ */
+#if defined(LINE_INTERNING) && defined(GAP_BUFFER_LINES)
+# error LINE_INTERNING cannot be used with GAP_BUFFER_LINES
+#endif
+#ifdef GAP_BUFFER_LINES
+ #include "vec_sg.hh"
+ typedef WordGapVecType  EditorCharVecType;
+#else
+ #include "vec_sp.hh"
+ typedef WordPtrVecType  EditorLineVecType;
+ typedef WordVecType     EditorCharVecType;
+#endif
+typedef unsigned short   EditorCharType;
+
 #ifdef ATTRIBUTE_CODES_IN_ANSI_ORDER
-  #include "vec_lp.hh"
-  typedef LongPtrVecType  EditorLineVecType;
-  typedef LongVecType     EditorCharVecType;
-  typedef unsigned long   EditorCharType;
+  typedef unsigned long  ScreenCharType;
+
+  /* Screen attribute for each style (defined in main.cc).
+   * StyleAttr has the xterm-256color attributes; StyleAttr16 has
+   * the same reduced to the 16 VGA colors, for the C64 mode.
+   * StyleTable points to the one in use. Entries that have not been
+   * assigned to a style map N into the VGA attribute N.
+   */
+  extern ScreenCharType        StyleAttr[256];
+  extern ScreenCharType        StyleAttr16[256];
+  extern const ScreenCharType* StyleTable;
 #endif
 #ifdef ATTRIBUTE_CODES_IN_VGA_ORDER
-  #include "vec_sp.hh"
-  typedef WordPtrVecType  EditorLineVecType;
-  typedef WordVecType     EditorCharVecType;
-  typedef unsigned short  EditorCharType;
+  typedef unsigned short ScreenCharType;
+#endif
+
+/* Number of cells that a line can hold without a heap allocation */
+#if defined(LINE_INLINE_CELLS) && !defined(GAP_BUFFER_LINES)
+# define EditorLineInlineCells LINE_INLINE_CELLS
+#else
+# define EditorLineInlineCells 0
 #endif
 
 static inline EditorCharType ExtractColor(EditorCharType ch)
@@ -38,16 +74,28 @@ static inline EditorCharType Recolor(EditorCharType ch, EditorCharType attr)
     return ExtractCharCode(ch) | ExtractColor(attr);
 }
 
-#ifdef ATTRIBUTE_CODES_IN_VGA_ORDER
 static inline unsigned Closest256attribute(unsigned c)
 {
 static const unsigned char Map256colors[256/2] = {0x10,0x32,0x54,0x76,0x98,0xBA,0xDC,0xFE,0x80,0x11,0x91,0x88,0x33,0x93,0x22,0x33,0x93,0x22,0x32,0x93,0x22,0xA2,0xBB,0xAA,0xAA,0xBB,0x88,0x11,0x91,0x88,0x38,0x93,0x82,0x38,0x93,0x22,0x72,0x97,0xA2,0x7A,0xBB,0xAA,0xAA,0xBB,0x44,0x55,0x95,0x84,0x55,0x95,0x66,0x77,0x97,0x66,0x77,0x97,0x66,0x77,0xB7,0xAA,0xAA,0xBB,0x44,0x55,0x95,0x44,0x55,0x95,0x66,0x77,0x97,0x66,0x77,0x77,0x66,0x77,0xB7,0xAA,0x7A,0xBB,0x44,0x55,0xD5,0xC4,0x55,0xD5,0x66,0x77,0xD7,0x66,0x77,0xD7,0x66,0x77,0xF7,0xEE,0xEE,0xFF,0xCC,0xCC,0xDD,0xCC,0xCC,0xDD,0xCC,0xCC,0xDD,0xCC,0x7C,0xDD,0xEE,0xEE,0xFF,0xEE,0xEE,0xFF,0x00,0x80,0x88,0x88,0x88,0x88,0x77,0x77,0x77,0x77,0xF7,0xFF};
     if(c&1) return Map256colors[c>>1] >> 4;
     return Map256colors[c>>1] & 0xF;
 }
-#endif
 
-static EditorCharType ComposeEditorChar(
+/* Create a 8-bit CGA/EGA/VGA attribute, shifted into the high byte */
+static inline unsigned ComposeVGAattribute(
+    unsigned char fg_color_index,
+    unsigned char bg_color_index,
+    unsigned char flags)
+{
+    unsigned result = 0;
+    result |= Closest256attribute(fg_color_index) << 8;
+    result |= Closest256attribute(bg_color_index) << 12;
+    result |= (flags & 0x20) <<10; // blink
+    result |= (flags & 0x08) << 8; // high-intens
+    return result;
+}
+
+static ScreenCharType ComposeEditorChar(
     unsigned char ch,
     unsigned char fg_color_index,
     unsigned char bg_color_index,
@@ -60,16 +108,12 @@ static EditorCharType ComposeEditorChar(
     }
 
 #ifdef ATTRIBUTE_CODES_IN_VGA_ORDER
-    EditorCharType result = ch;
-    // Create a 8-bit CGA/EGA/VGA attribute
-    result |= Closest256attribute(fg_color_index) << 8;
-    result |= Closest256attribute(bg_color_index) << 12;
-    result |= (flags & 0x20) <<10; // blink
-    result |= (flags & 0x08) << 8; // high-intens
+    ScreenCharType result = ch;
+    result |= ComposeVGAattribute(fg_color_index, bg_color_index, flags);
     return result;
 #endif
 #ifdef ATTRIBUTE_CODES_IN_ANSI_ORDER
-    EditorCharType result = ch;
+    ScreenCharType result = ch;
   #if 0
     if(fg_color_index < 16 && bg_color_index < 16)
     {
@@ -128,9 +172,19 @@ static inline EditorCharType MakeMarioColor(unsigned char ch)
     return ch | 0x0800;//ComposeEditorChar('\0', 8,0);
 }
 
-static /*inline*/ EditorCharType InvertColor(EditorCharType ch)
+/* Converts a cell from the buffer into what is put on the screen */
+static inline ScreenCharType ExpandEditorChar(EditorCharType ch)
+{
+#ifdef ATTRIBUTE_CODES_IN_ANSI_ORDER
+    return StyleTable[ch >> 8] | (ch & 0xFFu);
+#else
+    return ch;
+#endif
+}
+
+static /*inline*/ ScreenCharType InvertColor(ScreenCharType ch)
 {
-    if(sizeof(EditorCharType) > 2 && (ch & 0x80008000ul) == 0x80008000ul)
+    if(sizeof(ScreenCharType) > 2 && (ch & 0x80008000ul) == 0x80008000ul)
     {
         return ComposeEditorChar(ch, (unsigned char)(ch >> 16u),
                                      (unsigned char)( (unsigned(ch >> 8u)  & 0x7F)
@@ -140,27 +194,27 @@ static /*inline*/ EditorCharType InvertColor(EditorCharType ch)
     else
     {
         //return ComposeEditorChar(ch, (ch>>12)&0xF, (ch>>8)&0xF, ch>>24);
-        return (ch & ~EditorCharType(0xFF00u)) | ((ch << 4) & 0xF000u) | ((ch >> 4) & 0x0F00);
+        return (ch & ~ScreenCharType(0xFF00u)) | ((ch << 4) & 0xF000u) | ((ch >> 4) & 0x0F00);
     }
 }
 
-static inline EditorCharType RecolorBgOnly(EditorCharType ch, EditorCharType attr)
+static inline ScreenCharType RecolorBgOnly(ScreenCharType ch, ScreenCharType attr)
 {
-    if(sizeof(EditorCharType) > 2)
+    if(sizeof(ScreenCharType) > 2)
         return (ch & ~0x00FF0000ul) | (attr & 0x00FF0000ul) | 0x80008000ul;
     return (ch & ~0xF000u) | (attr & 0xF000u);
 }
 
-static inline void VidmemPutEditorChar(EditorCharType ch, unsigned short*& Tgt)
+static inline void VidmemPutEditorChar(ScreenCharType ch, unsigned short*& Tgt)
 {
-    if(sizeof(EditorCharType) > 2) Tgt[(DOSBOX_HICOLOR_OFFSET/2)] = (ch >> 16);
+    if(sizeof(ScreenCharType) > 2) Tgt[(DOSBOX_HICOLOR_OFFSET/2)] = (ch >> 16);
     *Tgt++ = ch;
     if(FatMode) *Tgt++ = ch | 0x80;
 }
-static inline EditorCharType VidmemReadEditorChar(unsigned short* Tgt)
+static inline ScreenCharType VidmemReadEditorChar(unsigned short* Tgt)
 {
     unsigned short attrlo = *Tgt;
-    if(sizeof(EditorCharType) == 2) return attrlo;
+    if(sizeof(ScreenCharType) == 2) return attrlo;
     unsigned short attrhi = Tgt[(DOSBOX_HICOLOR_OFFSET/2)];
     unsigned long attr = attrlo | (((unsigned long)attrhi) << 16u);
     return attr;
@@ -0,0 +1,322 @@
+/* Ad-hoc programming editor for DOSBox -- (C) 2011-03-08 Joel Yliluoma */
+/* A gap buffer with a std::vector-like interface,
+ * for pre-standard compilers that do not support templates at all.
+ *
+ * The storage has a gap (unused space) that is kept at the position
+ * of the most recent insert or erase. Repeated edits at the same spot
+ * (i.e. typing or backspacing at the cursor) are amortized O(1),
+ * because only the gap moves, never the tail of the line.
+ *
+ * Element access goes through operator[], which skips over the gap.
+ * Iterators are (vector,index) pairs rather than pointers.
+ * Only for plain-old-data element types (elements are moved with memmove).
+ *
+ * #defines to add before #include:  T       = element type
+ *                                   VecType = name of the vector class type to define
+ *                                   VecArena = if #defined, the name of an ArenaType object (arena.hh)
+ *                                              to allocate the storage from, instead of malloc.
+ */
+
+#ifndef gapBaseIncludes
+# define gapBaseIncludes
+# include <stdlib.h>
+# include <string.h>
+# include <stdio.h>
+#endif
+
+#define q(T,VecType) class VecType
+o(q)
+#undef q
+{
+public:
+    #define q(TT,VT) typedef TT T; typedef VT VecType;
+    o(q)
+    #undef q
+    #define q(T,VecType) VecType
+
+    typedef T value_type;
+    typedef T & reference;
+    typedef T const & const_reference;
+    typedef size_t size_type;
+
+    class const_iterator;
+    class iterator
+    {
+    public:
+        VecType*  v;
+        size_type i;
+        iterator(VecType* vv, size_type ii) : v(vv), i(ii) { }
+        reference operator* () const { return (*v)[i]; }
+        iterator& operator++ () { ++i; return *this; }
+        iterator& operator-- () { --i; return *this; }
+        iterator operator+ (long n) const { return iterator(v, i+n); }
+        iterator operator- (long n) const { return iterator(v, i-n); }
+        long operator- (const iterator& b) const { return (long)i - (long)b.i; }
+        int operator== (const iterator& b) const { return i == b.i; }
+        int operator!= (const iterator& b) const { return i != b.i; }
+    };
+    class const_iterator
+    {
+    public:
+        const VecType* v;
+        size_type      i;
+        const_iterator(const VecType* vv, size_type ii) : v(vv), i(ii) { }
+        const_iterator(const iterator& b) : v(b.v), i(b.i) { }
+        const_reference operator* () const { return (*v)[i]; }
+        const_iterator& operator++ () { ++i; return *this; }
+        const_iterator& operator-- () { --i; return *this; }
+        const_iterator operator+ (long n) const { return const_iterator(v, i+n); }
+        const_iterator operator- (long n) const { return const_iterator(v, i-n); }
+        long operator- (const const_iterator& b) const { return (long)i - (long)b.i; }
+        int operator== (const const_iterator& b) const { return i == b.i; }
+        int operator!= (const const_iterator& b) const { return i != b.i; }
+    };
+
+public:
+    o(q) () : data(0),len(0),cap(0),gap(0) { }
+    ~o(q) () { if(cap) FreeData(); }
+    o(q) (size_type length) : data(0),len(0),cap(0),gap(0)
+    {
+        resize(length);
+    }
+    o(q) (size_type length, T value) : data(0),len(0),cap(0),gap(0)
+    {
+        resize(length, value);
+    }
+    o(q) (const VecType& b) : data(0),len(0),cap(0),gap(0)
+    {
+        assign(b.begin(), b.end());
+    }
+#if defined(__cplusplus) && __cplusplus >= 201100L
+    o(q)(VecType&& b): data(b.data), len(b.len), cap(b.cap), gap(b.gap)
+    {
+        b.data = 0;
+        b.len  = 0;
+        b.cap  = 0;
+        b.gap  = 0;
+    }
+    VecType& operator= (VecType&& b)
+    {
+        if(&b != this) swap(b);
+        return *this;
+    }
+#endif
+    VecType& operator= (const VecType& b)
+    {
+        if(&b != this) assign(b.begin(), b.end());
+        return *this;
+    }
+
+    void assign(const_iterator first, const_iterator last)
+    {
+        if(first.v == this)
+        {
+            // Source is within this vector; take a copy first
+            VecType tmp;
+            tmp.assign(first, last);
+            swap(tmp);
+            return;
+        }
+        size_type newlen = last.i - first.i;
+        len = gap = 0;
+        Reserve(newlen);
+        first.v->CopyOut(data, first.i, newlen);
+        len = gap = newlen;
+    }
+    void assign(T const* first, T const* last)
+    {
+        size_type newlen = (size_type) (last-first);
+        len = gap = 0;
+        Reserve(newlen);
+        memcpy(data, first, newlen * sizeof(T));
+        len = gap = newlen;
+    }
+
+public:
+    reference operator[] (size_type ind)
+        { return ind < gap ? data[ind] : data[ind + (cap-len)]; }
+    const_reference operator[] (size_type ind) const
+        { return ind < gap ? data[ind] : data[ind + (cap-len)]; }
+    iterator begin() { return iterator(this, 0); }
+    iterator end()   { return iterator(this, len); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end()   const { return const_iterator(this, len); }
+    reference front() { return (*this)[0]; }
+    reference back()  { return (*this)[len-1]; }
+    const_reference front() const { return (*this)[0]; }
+    const_reference back()  const { return (*this)[len-1]; }
+
+    void push_back(T value)
+    {
+        if(len == cap) Reserve(cap ? cap*2 : 16);
+        MoveGap(len);
+        data[len++] = value;
+        gap = len;
+    }
+    void pop_back()
+    {
+        MoveGap(len);
+        gap = --len;
+    }
+
+    iterator insert(iterator pos, T value)
+    {
+        if(len == cap) Reserve(cap ? cap*2 : 16);
+        MoveGap(pos.i);
+        data[gap++] = value;
+        ++len;
+        return pos;
+    }
+    void insert(iterator pos, const_iterator first, const_iterator last)
+    {
+        size_type count = last.i - first.i;
+        if(!count) return;
+        if(first.v == this)
+        {
+            VecType tmp;
+            tmp.assign(first, last);
+            insert(pos, tmp.begin(), tmp.end());
+            return;
+        }
+        Reserve(len + count);
+        MoveGap(pos.i);
+        first.v->CopyOut(data + gap, first.i, count);
+        gap += count;
+        len += count;
+    }
+    void insert(iterator pos, T const* first, T const* last)
+    {
+        size_type count = (size_type) (last-first);
+        if(!count) return;
+        Reserve(len + count);
+        MoveGap(pos.i);
+        memcpy(data + gap, first, count * sizeof(T));
+        gap += count;
+        len += count;
+    }
+
+    void erase(iterator pos)
+    {
+        // Swallow the element after the gap into the gap
+        MoveGap(pos.i);
+        --len;
+    }
+    void erase(iterator first, iterator last)
+    {
+        size_type count = last.i - first.i;
+        if(!count) return;
+        MoveGap(first.i);
+        len -= count;
+    }
+
+    void reserve(size_type newcap)
+    {
+        if(cap < newcap) Reserve(newcap);
+    }
+
+    void resize(size_type newlen)
+    {
+        resize(newlen, (T)0);
+    }
+    void resize(size_type newlen, T value)
+    {
+        if(newlen <= len)
+        {
+            if(newlen < len) erase(begin()+newlen, end());
+            return;
+        }
+        if(newlen > cap) Reserve(newlen);
+        MoveGap(len);
+        while(len < newlen) data[len++] = value;
+        gap = len;
+    }
+
+    void swap(VecType& b)
+    {
+        {size_type l=b.len; b.len=len; len=l;}
+        {size_type l=b.cap; b.cap=cap; cap=l;}
+        {size_type l=b.gap; b.gap=gap; gap=l;}
+        {T * d = b.data; b.data=data; data=d;}
+    }
+
+    int empty() const { return len==0; }
+    void clear()
+    {
+        if(!cap) return;
+        FreeData();
+        data = 0;
+        len = cap = gap = 0;
+    }
+  #ifdef VecArena
+    /* Makes the vector empty without freeing anything.
+     * Only for use right before VecArena.ReleaseAll().
+     */
+    void forget()
+    {
+        data = 0;
+        len = cap = gap = 0;
+    }
+  #endif
+    size_type size()     const { return len; }
+    size_type capacity() const { return cap; }
+
+private:
+    /* Move the gap so that it begins at logical position pos */
+    void MoveGap(size_type pos)
+    {
+        size_type gaplen = cap - len;
+        if(pos < gap)
+            memmove(data + pos + gaplen, data + pos, (gap - pos) * sizeof(T));
+        else if(pos > gap)
+            memmove(data + gap, data + gap + gaplen, (pos - gap) * sizeof(T));
+        gap = pos;
+    }
+    /* Ensure the capacity is at least newcap. Preserves the gap position. */
+    void Reserve(size_type newcap)
+    {
+        if(newcap <= cap) return;
+        if(newcap < cap*2) newcap = cap*2;
+      #ifdef VecArena
+        T * newdata = (T *) VecArena.Allocate( newcap * sizeof(T) );
+      #else
+        T * newdata = (T *) malloc( newcap * sizeof(T) );
+      #endif
+        if(!newdata) fprintf(stdout, "VecType: Failed to allocate %u bytes\n", (unsigned)newcap);
+        size_type tail = len - gap;
+        if(gap)  memcpy(newdata, data, gap * sizeof(T));
+        if(tail) memcpy(newdata + newcap - tail, data + cap - tail, tail * sizeof(T));
+        if(cap) FreeData();
+        data = newdata;
+        cap  = newcap;
+    }
+    void FreeData()
+    {
+      #ifdef VecArena
+        VecArena.Deallocate(data, cap * sizeof(T));
+      #else
+        free(data);
+      #endif
+    }
+    /* Copy count elements beginning from logical position first into a flat array */
+    void CopyOut(T * target, size_type first, size_type count) const
+    {
+        if(first < gap)
+        {
+            size_type n = gap - first;
+            if(n > count) n = count;
+            memcpy(target, data + first, n * sizeof(T));
+            target += n;
+            first  += n;
+            count  -= n;
+        }
+        if(count)
+            memcpy(target, data + first + (cap-len), count * sizeof(T));
+    }
+
+private:
+    T * data;
+    size_type len, cap;
+    size_type gap; // Logical position where the gap begins
+
+    #undef q
+};
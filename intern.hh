@@ -0,0 +1,177 @@
+/* Ad-hoc programming editor for DOSBox -- (C) 2011-03-08 Joel Yliluoma */
+#ifndef bqtInternHH
+#define bqtInternHH
+
+/* A table of shared, immutable line contents (interning).
+ *
+ * Intern() looks up the given bytes in a hash table. If an identical
+ * payload already exists, its reference count is incremented and it
+ * is returned; otherwise a new payload is made from a copy of the bytes.
+ * Lines with the same characters and the same colors (e.g. blank lines,
+ * or repeated boilerplate) can therefore all point to one payload.
+ *
+ * Payloads are never modified. A vector that holds one must make
+ * a private copy of it before changing anything (see VecIntern
+ * in vecbase.hh), and Release() it when it no longer needs it.
+ *
+ * ReleaseAll() frees every payload at once. Like ArenaType::ReleaseAll(),
+ * whoever calls it must make sure that none of them are used afterwards.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+class InternTableType
+{
+public:
+    /* Statistics, in bytes unless otherwise noted */
+    unsigned long num_payloads;  // Number of distinct payloads
+    unsigned long payload_bytes; // Total size of their contents
+    unsigned long num_refs;      // Number of vectors that point to them
+    unsigned long shared_bytes;  // What those vectors would take without sharing
+    unsigned long num_buckets;   // Size of the hash table, in entries
+
+public:
+    InternTableType() : buckets(0)
+    {
+        num_buckets = 0;
+        ResetStats();
+    }
+    ~InternTableType()
+    {
+        ReleaseAll();
+    }
+
+    /* Returns a payload with the same contents as p[0..bytes-1],
+     * or 0 if there was not enough memory for one.
+     */
+    void* Intern(const void* p, size_t bytes)
+    {
+        if(num_payloads >= num_buckets && !Grow()) return 0;
+        unsigned long h = Hash(p, bytes);
+        Entry** slot = &buckets[h & (num_buckets-1)];
+        for(Entry* e = *slot; e; e = e->next)
+            if(e->hash == h && e->bytes == bytes && !memcmp(e+1, p, bytes))
+            {
+                AddRef(e+1);
+                return e+1;
+            }
+        Entry* e = (Entry*) malloc(sizeof(Entry) + bytes);
+        if(!e) return 0;
+        memcpy(e+1, p, bytes);
+        e->next  = *slot;
+        e->hash  = h;
+        e->refs  = 0;
+        e->bytes = bytes;
+        *slot    = e;
+        num_payloads  += 1;
+        payload_bytes += bytes;
+        AddRef(e+1);
+        return e+1;
+    }
+
+    void AddRef(void* payload)
+    {
+        Entry* e = (Entry*)payload - 1;
+        e->refs      += 1;
+        num_refs     += 1;
+        shared_bytes += e->bytes;
+    }
+
+    void Release(void* payload)
+    {
+        Entry* e = (Entry*)payload - 1;
+        num_refs     -= 1;
+        shared_bytes -= e->bytes;
+        if(--e->refs) return;
+
+        Entry** slot = &buckets[e->hash & (num_buckets-1)];
+        while(*slot != e) slot = &(*slot)->next;
+        *slot = e->next;
+        num_payloads  -= 1;
+        payload_bytes -= e->bytes;
+        free(e);
+    }
+
+    /* Frees every payload and the hash table. */
+    void ReleaseAll()
+    {
+        for(unsigned long b=0; b<num_buckets; ++b)
+            while(buckets[b])
+            {
+                Entry* next = buckets[b]->next;
+                free(buckets[b]);
+                buckets[b] = next;
+            }
+        free(buckets);
+        buckets     = 0;
+        num_buckets = 0;
+        ResetStats();
+    }
+
+    /* Memory used by the table itself: the hash table and the payload headers */
+    unsigned long OverheadBytes() const
+    {
+        return num_buckets * sizeof(Entry*) + num_payloads * sizeof(Entry);
+    }
+
+private:
+    // Not copyable
+    InternTableType(const InternTableType&);
+    void operator=(const InternTableType&);
+
+    /* The payload follows its header */
+    struct Entry
+    {
+        Entry*        next; // Next entry in the same bucket
+        unsigned long hash;
+        unsigned long refs;
+        size_t        bytes;
+    };
+
+    static unsigned long Hash(const void* p, size_t bytes)
+    {
+        // FNV-1a
+        const unsigned char* s = (const unsigned char*)p;
+        unsigned long h = 2166136261ul;
+        for(size_t a=0; a<bytes; ++a)
+            h = (h ^ s[a]) * 16777619ul;
+        return h;
+    }
+
+    /* Doubles the number of buckets */
+    bool Grow()
+    {
+        unsigned long n = num_buckets ? num_buckets*2 : 1024;
+        Entry** b = (Entry**) calloc(n, sizeof(Entry*));
+        if(!b) return false;
+        for(unsigned long a=0; a<num_buckets; ++a)
+            while(buckets[a])
+            {
+                Entry* e   = buckets[a];
+                buckets[a] = e->next;
+                e->next    = b[e->hash & (n-1)];
+                b[e->hash & (n-1)] = e;
+            }
+        free(buckets);
+        buckets     = b;
+        num_buckets = n;
+        return true;
+    }
+
+    void ResetStats()
+    {
+        num_payloads = payload_bytes = 0;
+        num_refs     = shared_bytes  = 0;
+    }
+
+private:
+    Entry** buckets;
+};
+
+#ifdef LINE_INTERNING
+/* The table of shared lines of the editor buffer (defined in main.cc) */
+extern InternTableType LineIntern;
+#endif
+
+#endif
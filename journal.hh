@@ -0,0 +1,372 @@
+/* Ad-hoc programming editor for DOSBox -- (C) 2011-03-08 Joel Yliluoma */
+#ifndef bqtJournalHH
+#define bqtJournalHH
+
+/* A journal of the edits made since the file was loaded or saved,
+ * for recovering them if the editor dies.
+ *
+ * Each edit (where, how many cells were deleted, and the characters
+ * that were inserted) is encoded into a buffer in memory. The buffer
+ * is appended to the journal file in one write when the editor becomes
+ * idle, so a burst of typing costs one write, not one per key.
+ *
+ * The journal file is next to the file, with $J and the first character
+ * of the extension of the file as its extension (foo.c -> foo.$Jc).
+ * Its header records the name of the file (without the directory), and
+ * the size and the modification time that the file had when the journal
+ * was begun. Resume() only accepts the journal if the file still has
+ * them, i.e. the journal is newer than the file. A journal file that
+ * has the name of another file is left alone, and then this file is
+ * not journaled (see Active()).
+ * The journal file is created when the first edit is written into it,
+ * and removed when the file is saved or the buffer is discarded.
+ *
+ * Each edit is stored as x, y, n_delete and n_insert, as numbers
+ * of 7 bits per byte, followed by the n_insert characters.
+ * If the last edit was cut short (the editor died while writing it),
+ * it is ignored.
+ *
+ * #include "chartype.hh" before this file (for EditorCharVecType).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+class JournalType
+{
+public:
+    typedef EditorCharVecType T;
+
+    /* Statistics */
+    unsigned long num_edits;   // Number of edits in the journal
+    unsigned long written;     // Bytes of edits written into the journal file
+    unsigned long num_flushes; // Number of writes into the journal file
+
+public:
+    JournalType() : fp(0), name(0), base(0), buf(0), fill(0), cap(0), replay(0), replay_pos(0), replay_end(0)
+    {
+        num_edits = written = num_flushes = 0;
+        base_size = base_time = 0;
+    }
+    ~JournalType()
+    {
+        // Keep the journal file; that is the point of it
+        Close();
+        free(buf);
+    }
+
+    /* Begins a new journal for the file. The previous journal is removed. */
+    void Open(const char* filename)
+    {
+        Remove();
+        const char* b = BaseName(filename);
+        name = NameFor(filename);
+        base = (char*) malloc(strlen(b) + 1);
+        if(base) strcpy(base, b);
+        GetBase(filename, base_size, base_time);
+        // Leave alone a file that is not a journal of this file
+        FILE* f = name && base ? fopen(name, "rb") : 0;
+        if(f)
+        {
+            unsigned long size, time;
+            bool own = ReadHeader(f, size, time);
+            fclose(f);
+            if(!own) Forget();
+        }
+        if(!base) Forget();
+    }
+
+    /* Whether the file is being journaled */
+    bool Active() const { return name != 0; }
+
+    /* Whether the file has a journal that was begun from the file as it
+     * is now. If so, the journal is continued, and its edits are given
+     * by Next(). Otherwise, a new journal is begun.
+     */
+    bool Resume(const char* filename)
+    {
+        Open(filename);
+        if(!name) return false;
+        FILE* f = fopen(name, "rb");
+        if(!f) return false;
+        unsigned long size = 0, jsize, jtime;
+        if(ReadHeader(f, jsize, jtime)
+        && jsize == (base_size & 0xFFFFFFFFul)
+        && jtime == (base_time & 0xFFFFFFFFul))
+        {
+            fseek(f, 0, SEEK_END);
+            size   = ftell(f) - Header();
+            replay = (unsigned char*) malloc(size ? size : 1);
+            fseek(f, (long)Header(), SEEK_SET);
+            if(replay) size = fread(replay, 1, size, f);
+        }
+        fclose(f);
+        if(!replay) { Remove(); Open(filename); return false; }
+
+        // Find out how much of it is intact, and write that into a new journal
+        replay_end = 0;
+        for(unsigned long p = 0; ; ++num_edits)
+        {
+            unsigned long x, y, n_delete, n_insert;
+            if(!GetNum(replay, size, p, x) || !GetNum(replay, size, p, y)
+            || !GetNum(replay, size, p, n_delete) || !GetNum(replay, size, p, n_insert)
+            || n_insert > size - p)
+                break;
+            p += n_insert;
+            replay_end = p;
+        }
+        replay_pos = 0;
+        fp = fopen(name, "w+b");
+        if(fp)
+        {
+            WriteHeader();
+            fwrite(replay, 1, replay_end, fp);
+            fflush(fp);
+            written = replay_end;
+        }
+        return true;
+    }
+
+    /* The next edit in the journal that was resumed. Returns false at the end. */
+    bool Next(unsigned& x, unsigned& y, unsigned& n_delete,
+              const unsigned char*& insert, unsigned& n_insert)
+    {
+        unsigned long v[4];
+        if(!replay || replay_pos >= replay_end)
+        {
+            free(replay);
+            replay = 0;
+            return false;
+        }
+        for(unsigned a=0; a<4; ++a) GetNum(replay, replay_end, replay_pos, v[a]);
+        x = v[0]; y = v[1]; n_delete = v[2]; n_insert = v[3];
+        insert = replay + replay_pos;
+        replay_pos += n_insert;
+        return true;
+    }
+
+    /* Records an edit. It is written into the file by Flush(). */
+    void Add(unsigned x, unsigned y, unsigned n_delete, const T& insert_chars)
+    {
+        // The edits that are replayed are in the journal already
+        if(!name || replay) return;
+        unsigned long n_insert = insert_chars.size();
+        if(!Reserve(4*5 + n_insert)) return;
+        PutNum(x);
+        PutNum(y);
+        PutNum(n_delete);
+        PutNum(n_insert);
+        for(unsigned long a=0; a<n_insert; ++a)
+            buf[fill++] = (unsigned char) ExtractCharCode(insert_chars[a]);
+        num_edits += 1;
+        if(fill >= FlushSize) Flush();
+    }
+
+    /* Writes the recorded edits into the journal file */
+    void Flush()
+    {
+        if(!fill) return;
+        if(!fp)
+        {
+            fp = fopen(name, "w+b");
+            if(!fp) { fill = 0; return; }
+            WriteHeader();
+        }
+        fwrite(buf, 1, fill, fp);
+        fflush(fp);
+        written += fill;
+        fill = 0;
+        num_flushes += 1;
+    }
+
+    /* Where the journal is now, for Rebase() */
+    unsigned long Mark()
+    {
+        Flush();
+        return written;
+    }
+
+    /* The file was saved with the edits up to the mark. Begins a new
+     * journal for it, with the edits that were made after the mark.
+     */
+    void Rebase(const char* filename, unsigned long mark)
+    {
+        Flush();
+        unsigned long size = written > mark ? written - mark : 0;
+        unsigned char* tail = 0;
+        if(size && fp && (tail = (unsigned char*) malloc(size)) != 0)
+        {
+            fseek(fp, (long)(Header() + mark), SEEK_SET);
+            size = fread(tail, 1, size, fp);
+            fseek(fp, 0, SEEK_END);
+        }
+        Open(filename);
+        if(tail && Reserve(size))
+        {
+            memcpy(buf, tail, size);
+            fill = size;
+            Flush();
+        }
+        free(tail);
+    }
+
+    /* Removes the journal file, and stops journaling */
+    void Remove()
+    {
+        fill = 0;
+        Close();
+        if(name) remove(name);
+        Forget();
+    }
+
+private:
+    // Not copyable
+    JournalType(const JournalType&);
+    void operator=(const JournalType&);
+
+    enum { HeaderSize = 14, // Then the name of the file
+           FlushSize  = 65536 };
+    static const char* Magic() { return "EdJ2"; }
+
+    void Close()
+    {
+        Flush();
+        if(fp) fclose(fp);
+        fp = 0;
+        free(replay);
+        replay = 0;
+        fill = 0;
+        num_edits = written = 0;
+    }
+
+    /* Stops journaling, without removing the journal file */
+    void Forget()
+    {
+        free(name);
+        free(base);
+        name = 0;
+        base = 0;
+    }
+
+    static char* NameFor(const char* filename)
+    {
+        size_t len = strlen(filename);
+        char* s = (char*) malloc(len + 5);
+        if(!s) return 0;
+        strcpy(s, filename);
+        // Replace the extension, if there is one in the last path component
+        char* ext = strrchr(s, '.');
+        if(!ext || strpbrk(ext, "/\\:")) ext = s + len;
+        char tail[5] = ".$J$";
+        if(ext[0] && ext[1]) tail[3] = ext[1];
+        strcpy(ext, tail);
+        return s;
+    }
+    static const char* BaseName(const char* filename)
+    {
+        const char* b = filename;
+        for(const char* p = filename; *p; ++p)
+            if(*p == '/' || *p == '\\' || *p == ':') b = p+1;
+        return b;
+    }
+    /* Size of the header of the journal file, with the name */
+    unsigned long Header() const
+    {
+        return HeaderSize + strlen(base);
+    }
+    static void GetBase(const char* filename, unsigned long& size, unsigned long& time)
+    {
+        struct stat st;
+        if(stat(filename, &st) == 0)
+            { size = st.st_size; time = st.st_mtime; }
+        else
+            { size = 0; time = 0; }
+    }
+    void WriteHeader()
+    {
+        unsigned char hdr[HeaderSize];
+        size_t len = strlen(base);
+        memcpy(hdr, Magic(), 4);
+        Put32(hdr+4, base_size);
+        Put32(hdr+8, base_time);
+        hdr[12] = (unsigned char)len; hdr[13] = (unsigned char)(len >> 8);
+        fwrite(hdr, 1, HeaderSize, fp);
+        fwrite(base, 1, len, fp);
+    }
+    /* Reads the header of the journal file. Returns false if it is not
+     * a journal of this file. Otherwise gives the size and the time
+     * that are in it, and leaves f at the first edit.
+     */
+    bool ReadHeader(FILE* f, unsigned long& size, unsigned long& time) const
+    {
+        unsigned char hdr[HeaderSize];
+        size_t len = strlen(base);
+        if(fread(hdr, 1, HeaderSize, f) != HeaderSize
+        || memcmp(hdr, Magic(), 4)
+        || (hdr[12] | ((size_t)hdr[13] << 8)) != len)
+            return false;
+        for(size_t a=0; a<len; ++a)
+            if(fgetc(f) != (unsigned char)base[a])
+                return false;
+        size = Get32(hdr+4);
+        time = Get32(hdr+8);
+        return true;
+    }
+
+    bool Reserve(unsigned long more)
+    {
+        if(fill + more <= cap) return true;
+        unsigned long newcap = (fill + more) * 2;
+        unsigned char* b = (unsigned char*) realloc(buf, newcap);
+        if(!b) return false;
+        buf = b;
+        cap = newcap;
+        return true;
+    }
+    void PutNum(unsigned long value)
+    {
+        while(value >= 0x80) { buf[fill++] = (unsigned char)(value | 0x80); value >>= 7; }
+        buf[fill++] = (unsigned char)value;
+    }
+    static bool GetNum(const unsigned char* p, unsigned long size, unsigned long& pos, unsigned long& value)
+    {
+        value = 0;
+        for(unsigned shift=0; pos < size && shift < 32; shift += 7)
+        {
+            unsigned char b = p[pos++];
+            value |= (unsigned long)(b & 0x7F) << shift;
+            if(!(b & 0x80)) return true;
+        }
+        return false;
+    }
+    static void Put32(unsigned char* p, unsigned long v)
+    {
+        p[0] = (unsigned char)v;         p[1] = (unsigned char)(v >> 8);
+        p[2] = (unsigned char)(v >> 16); p[3] = (unsigned char)(v >> 24);
+    }
+    static unsigned long Get32(const unsigned char* p)
+    {
+        return (unsigned long)p[0]         | ((unsigned long)p[1] << 8)
+            | ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+    }
+
+private:
+    FILE*          fp;
+    char*          name;       // Name of the journal file, or 0 if not journaling
+    char*          base;       // Name of the file, without the directory
+    unsigned long  base_size;  // The file when the journal was begun
+    unsigned long  base_time;
+    unsigned char* buf;        // Edits not written yet
+    unsigned long  fill, cap;
+    unsigned char* replay;     // The edits of the resumed journal
+    unsigned long  replay_pos, replay_end;
+};
+
+#ifdef EDIT_JOURNAL
+/* The journal of the editor buffer (defined in main.cc) */
+extern JournalType Journal;
+#endif
+
+#endif
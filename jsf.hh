@@ -17,12 +17,16 @@ class JSF
 #endif
 {
 public:
-    JSF() : states(nullptr)
+    JSF() : states(nullptr), nstates(0), nclasses(0), start(0), table(nullptr), attrs(nullptr), statelist(nullptr)
     {
+        ForgetCheckpoints();
     }
     ~JSF()
     {
         //Clear();
+        free(table);
+        free(attrs);
+        free(statelist);
     }
     void Parse(const char* fn)
     {
@@ -37,6 +41,8 @@ public:
         //fprintf(stdout, "Parsing syntax file... "); fflush(stdout);
         TabType colortable;
         bool colors_sorted = false;
+        // The checkpoints refer to the old states
+        ForgetCheckpoints();
         //Clear();
         while(fgets(Buf, sizeof(Buf), fp))
         {
@@ -73,7 +79,7 @@ public:
         int recolor, markbegin, markend;
         bool recolormark, noeat;
         unsigned char c;
-        state* s;
+        unsigned short s; // Index of the state (see Compile())
     };
     void ApplyInit(ApplyState& state)
     {
@@ -81,7 +87,41 @@ public:
         state.buffering = state.noeat = false;
         state.recolor = state.markbegin = state.markend = 0;
         state.c = '?';
-        state.s = states;
+        state.s = start;
+    }
+
+    /* Checkpoints are the ApplyStates found at the beginnings of lines,
+     * kept so that applying can later be resumed from there.
+     * Equal states get the same number, 1..254; 0 means that there
+     * was no room for it. The numbers remain valid until ForgetCheckpoints().
+     * The numbers fit in the color byte of a cell, and skip the color of
+     * MakeUnknownColor(), which is what a line that was not highlighted has.
+     */
+    enum { MaxCheckpoints = 253 };
+    unsigned Checkpoint(const ApplyState& state)
+    {
+        unsigned h = CheckpointHash(state), n;
+        for(; (n = checkpoint_index[h]) != 0; h = (h+1) % CheckpointSlots)
+            if(SameState(checkpoints[n-1], state))
+                return CheckpointNumber(n);
+        if(ncheckpoints == MaxCheckpoints) return 0;
+        checkpoints[ncheckpoints] = state;
+        checkpoint_index[h] = ++ncheckpoints;
+        return CheckpointNumber(ncheckpoints);
+    }
+    /* Sets state to checkpoint n. Returns false if there is no such checkpoint. */
+    bool ApplyResume(ApplyState& state, unsigned n) const
+    {
+        if(n == CheckpointSkipped()) return false;
+        if(n > CheckpointSkipped()) --n;
+        if(n < 1 || n > ncheckpoints) return false;
+        state = checkpoints[n-1];
+        return true;
+    }
+    void ForgetCheckpoints()
+    {
+        ncheckpoints = 0;
+        memset(checkpoint_index, 0, sizeof(checkpoint_index));
     }
 #if defined(__cplusplus) && __cplusplus >= 199700L
     void Apply( ApplyState& state )
@@ -90,6 +130,7 @@ public:
     {
         virtual cdecl int Get(void) = 0;
         virtual cdecl void Recolor(register unsigned distance, register unsigned n, register EditorCharType attr) = 0;
+        virtual cdecl int LineBegins(unsigned checkpoint, int settled) = 0;
     };
     void Apply( ApplyState& state, Applier& app)
 #endif
@@ -97,9 +138,10 @@ public:
 #if defined(__cplusplus) && __cplusplus >= 199700L
         DerivedClass& app = *this;
 #endif
+        if(!table) return; // Compile() failed
         for(;;)
         {
-            /*fprintf(stdout, "[State %s]", state.s->name);*/
+            /*fprintf(stdout, "[State %s]", statelist[state.s]->name);*/
             if(state.noeat)
             {
                 state.noeat = false;
@@ -107,6 +149,19 @@ public:
             }
             else
             {
+                if(state.c == '\n')
+                {
+                    /* A line begins. Like in JOE, the marks do not reach
+                     * back past the beginning of the line.
+                     * The applier is told the checkpoint for this state, and
+                     * whether anything before the newline can still be recolored
+                     * (by a pending recolor or a buffered string).
+                     * It may stop here by returning 0.
+                     */
+                    state.markbegin = state.markend = 0;
+                    if(!app.LineBegins(Checkpoint(state), !state.buffering && state.recolor <= 1))
+                        break;
+                }
                 int ch = app.Get();
                 if(ch < 0) break;
                 state.c       = ch;
@@ -116,55 +171,116 @@ public:
             }
             if(state.recolor)
             {
-                app.Recolor(0, state.recolor, state.s->attr);
+                app.Recolor(0, state.recolor, attrs[state.s]);
             }
             if(state.recolormark)
             {
                 // markbegin & markend say how many characters AGO it was marked
-                app.Recolor(state.markend+1, state.markbegin - state.markend, state.s->attr);
+                app.Recolor(state.markend+1, state.markbegin - state.markend, attrs[state.s]);
             }
 
-            option *o = state.s->options[state.c];
-            state.recolor     = o->recolor;
-            state.recolormark = o->recolormark;
-            state.noeat       = o->noeat;
-            state.s           = o->state;
-            if(o->strings)
+            const transition& t = table[state.s * nclasses + byteclass[state.c]];
+            unsigned char flags = t.flags;
+            state.recolor     = t.recolor;
+            state.recolormark = (flags & TrRecolorMark) != 0;
+            state.noeat       = (flags & TrNoEat) != 0;
+            if(flags & TrStrings)
             {
+                // The string table is only needed here, so it is
+                // looked up from the option that the table was made from
+                const option* o = statelist[state.s]->options[state.c];
                 const char* k = (const char*) &state.buffer[0];
                 unsigned    n = state.buffer.size();
-                struct state* ns = o->strings==1
-                        ? findstate(o->stringtable, k, n)
-                        : findstate_i(o->stringtable, k, n);
+                struct state* ns = o->keywords ? findkeyword(*o, k, n)
+                                 : o->strings==1 ? findstate(o->stringtable, k, n)
+                                 : findstate_i(o->stringtable, k, n);
                 /*fprintf(stdout, "Tried '%.*s' for %p (%s)\n",
                     n,k, ns, ns->name);*/
+                state.s = t.state;
                 if(ns)
                 {
-                    state.s = ns;
+                    state.s = ns->index;
                     state.recolor = state.buffer.size()+1;
                 }
                 state.buffer.clear();
                 state.buffering = false;
             }
-            else if(state.buffering && !state.noeat)
-                state.buffer.push_back(state.c);
-            if(o->buffer)
+            else
+            {
+                state.s = t.state;
+                if(state.buffering && !state.noeat)
+                    state.buffer.push_back(state.c);
+            }
+            if(flags & TrBuffer)
                 { state.buffering = true;
                   state.buffer.assign(&state.c, &state.c + 1); }
-            if(o->mark)    { state.markbegin = 0; }
-            if(o->markend) { state.markend   = 0; }
+            if(flags & TrMark)    { state.markbegin = 0; }
+            if(flags & TrMarkEnd) { state.markend   = 0; }
         }
     }
 private:
+    enum { CheckpointSlots = 512 };
+    /* The number of the nth checkpoint (from 1) */
+    static unsigned CheckpointNumber(unsigned n)
+    {
+        return n < CheckpointSkipped() ? n : n+1;
+    }
+    static unsigned CheckpointSkipped()
+    {
+        return ExtractColor(MakeUnknownColor(0)) >> 8;
+    }
+    static unsigned CheckpointHash(const ApplyState& state)
+    {
+        unsigned long h = (unsigned long)state.s;
+        h = h*31 + state.c;
+        h = h*31 + (unsigned)state.recolor;
+        h = h*4  + state.buffering*2 + state.recolormark;
+        for(unsigned a=0; a<state.buffer.size(); ++a)
+            h = h*31 + state.buffer[a];
+        return (unsigned)((h ^ (h >> 9) ^ (h >> 18)) % CheckpointSlots);
+    }
+    static bool SameState(const ApplyState& a, const ApplyState& b)
+    {
+        return a.s == b.s && a.c == b.c
+            && a.recolor == b.recolor && a.recolormark == b.recolormark
+            && a.markbegin == b.markbegin && a.markend == b.markend
+            && a.noeat == b.noeat && a.buffering == b.buffering
+            && a.buffer.size() == b.buffer.size()
+            && (!a.buffer.size() || !memcmp(&a.buffer[0], &b.buffer[0], a.buffer.size()));
+    }
+    ApplyState    checkpoints[MaxCheckpoints];
+    unsigned      ncheckpoints;
+    unsigned char checkpoint_index[CheckpointSlots]; // Hash table of checkpoint numbers
+
     struct option;
     struct state
     {
         state*         next;
         char*          name;
         EditorCharType attr;
+        unsigned short index; // In statelist
         option* options[256];
         // Note: cleared using memset
     }* states;
+
+    /* The machine compiled for Apply() (see Compile()).
+     * The bytes that every state treats the same way form a class.
+     * For each state and class, table[] tells what to do.
+     */
+    enum { TrNoEat = 1, TrBuffer = 2, TrMark = 4, TrMarkEnd = 8,
+           TrRecolorMark = 16, TrStrings = 32 };
+    struct transition
+    {
+        unsigned short state;   // Index of the next state
+        unsigned char  recolor;
+        unsigned char  flags;   // Tr*
+    };
+    unsigned char   byteclass[256];
+    unsigned        nstates, nclasses;
+    unsigned short  start;      // Index of the first state
+    transition*     table;      // [nstates * nclasses]
+    EditorCharType* attrs;      // [nstates]
+    state**         statelist;  // [nstates]
     struct table_item
     {
         char*  token;
@@ -204,9 +320,20 @@ private:
     #undef o
     #undef UsePlacementNew
 
+    /* A slot in the perfect hash of a string table (see HashKeywords()) */
+    struct keyword
+    {
+        const char*    token;  // nullptr = empty slot
+        struct state*  state;
+        unsigned short length;
+    };
+
     struct option
     {
         TabType stringtable;
+        keyword*        keywords; // [1 << keybits], or nullptr if not hashed
+        unsigned short* keyseeds; // [1 << seedbits]
+        unsigned char   keybits, seedbits;
         union
         {
             struct state* state;
@@ -219,7 +346,7 @@ private:
         bool     name_mapped:1; // whether state(1) or state_name(0) is valid
         bool     mark:1, markend:1, recolormark:1;
 
-        option(): stringtable(),state(nullptr),recolor(0),noeat(0),buffer(0),strings(0),name_mapped(0),mark(0),markend(0),recolormark(0)
+        option(): stringtable(),keywords(nullptr),keyseeds(nullptr),keybits(0),seedbits(0),state(nullptr),recolor(0),noeat(0),buffer(0),strings(0),name_mapped(0),mark(0),markend(0),recolormark(0)
         {
         }
     };
@@ -280,6 +407,47 @@ private:
         if(!attr) attr |= 0x80000000ul; // set 1 dummy bit in order to differentiate from nuls
         return attr;
     }
+    /* Converts a screen attribute (from ComposeEditorChar) into a cell
+     * with the character code 0. In the 32-bit code, this assigns a new
+     * style for the attribute, unless the style table already has it.
+     * Called when the syntax file is parsed.
+     */
+    inline static EditorCharType InternStyle(ScreenCharType attr)
+    {
+#ifdef ATTRIBUTE_CODES_IN_ANSI_ORDER
+        // Styles are assigned in order, beginning from 1
+        static unsigned next_id = 1;
+        attr &= ~0xFFul;
+        {for(unsigned id=0; id<next_id && id<256; ++id)
+            if(StyleAttr[id] == attr)
+                return id << 8;}
+
+        // Find an entry that is not assigned to a style yet, skipping those
+        // that are used by MakeDefaultColor, MakeUnknownColor and MakeJSFerrorColor.
+        while(next_id < 256
+           && (next_id == (MakeDefaultColor(0) >> 8)
+            || next_id == (MakeUnknownColor(0) >> 8)
+            || next_id == (MakeJSFerrorColor(0) >> 8))) ++next_id;
+        if(next_id >= 256)
+        {
+            fprintf(stdout, "Too many different colors; using the error color instead\n");
+            return MakeJSFerrorColor(0);
+        }
+        unsigned id = next_id++;
+        StyleAttr[id] = attr;
+        if((attr & 0x80008000ul) == 0x80008000ul) // An extended attribute
+        {
+            unsigned char fg = (unsigned(attr >> 8u) & 0x7F) | (unsigned(attr >> 23u) & 0x80);
+            unsigned char bg = attr >> 16u;
+            StyleAttr16[id] = ComposeVGAattribute(fg, bg, attr >> 24u);
+        }
+        else
+            StyleAttr16[id] = attr;
+        return id << 8;
+#else
+        return attr & 0xFF00u;
+#endif
+    }
     inline void ParseColorDeclaration(char* line, TabType& colortable)
     {
         while(*line==' '||*line=='\t') ++line;
@@ -322,7 +490,7 @@ private:
             }
             else
             {
-                s->attr = (EditorCharType)(unsigned long)c;
+                s->attr = InternStyle((unsigned long)c);
             }
         }
         s->next = states;
@@ -445,6 +613,9 @@ private:
                 while(*line != '\0') ++line;
                 /*unsigned char* value_end   = (unsigned char*) line;
                 *value_end++ = '\0';*/
+                if(o->strings == 2)
+                    for(char* p = key_begin; *p; ++p)
+                        *p = FoldCase(*p);
                 if(*key_begin && *value_begin)
                 {
                     table_item item;
@@ -498,7 +669,8 @@ private:
         }
         return 0;
     }
-    // Case-ignorant version
+    // Case-ignorant version.
+    // The tokens of istrings have been converted into lowercase.
     static state* findstate_i(const TabType& table, const char* s, register unsigned n=0)
     {
         if(!n) n = strlen(s);
@@ -519,6 +691,39 @@ private:
         return 0;
     }
 
+    // Search the perfect hash of an option's string table.
+    // Costs one hash and one comparison.
+    static state* findkeyword(const option& o, const char* s, unsigned n)
+    {
+        bool fold = o.strings == 2;
+        unsigned long h = KeywordHash(s, n, fold);
+        const keyword& w = o.keywords[KeywordSlot(h, o.keyseeds[h & ((1u << o.seedbits) - 1)], o.keybits)];
+        if(w.length != n) return 0; // Also catches empty slots
+        if(!fold) return memcmp(w.token, s, n) ? 0 : w.state;
+        {for(unsigned a=0; a<n; ++a)
+            if(FoldCase(s[a]) != w.token[a]) return 0;}
+        return w.state;
+    }
+    static inline char FoldCase(char c)
+    {
+        return (unsigned char)(c - 'A') < 26u ? c + ('a'-'A') : c;
+    }
+    /* The keyword hash is FNV-1a. It selects a bucket, and the
+     * seed of that bucket then scatters it into its slot.
+     */
+    static inline unsigned long KeywordHash(const char* s, unsigned n, bool fold)
+    {
+        unsigned long h = 2166136261ul;
+        for(; n > 0; --n, ++s)
+            h = ((h ^ (unsigned char)(fold ? FoldCase(*s) : *s)) * 16777619ul) & 0xFFFFFFFFul;
+        return h;
+    }
+    static inline unsigned KeywordSlot(unsigned long h, unsigned seed, unsigned bits)
+    {
+        h = ((h ^ (seed * 0x9E3779B9ul)) * 0x85EBCA6Bul) & 0xFFFFFFFFul;
+        return (unsigned)(h >> (32 - bits));
+    }
+
     // Converted state-names into pointers to state structures for fast access
     void Remap(option*& o, TabType& state_cache, unsigned a, const char* statename)
     {
@@ -595,6 +800,181 @@ private:
             // Get the first-inserted state (last in chain) as starting-point.
             states = states->next;
         }
+        Compile(state_cache);
+    }
+    /* Numbers the states and makes the table for Apply().
+     * The table is small enough to stay in the cache: the states
+     * only have a few dozen different options, so there are only
+     * a few dozen classes of bytes instead of 256 options per state.
+     */
+    void Compile(const TabType& state_cache)
+    {
+        free(table);     table     = nullptr;
+        free(attrs);     attrs     = nullptr;
+        free(statelist); statelist = nullptr;
+        nstates  = 0;
+        nclasses = 0;
+        // The states, and any others that their options lead to
+        // (such as those of the file that was parsed before)
+        {for(unsigned n=0; n<state_cache.size(); ++n)
+            if(!AddState(state_cache[n].state)) return;}
+        {for(unsigned n=0; n<nstates; ++n)
+            for(unsigned a=0; a<256; ++a)
+            {
+                option* o = statelist[n]->options[a];
+                if(!o || !o->name_mapped) continue;
+                if(o->state && !AddState(o->state)) return;
+                for(unsigned k=0; k<o->stringtable.size(); ++k)
+                    if(o->stringtable[k].state && !AddState(o->stringtable[k].state)) return;
+                if(o->strings && !o->keywords) HashKeywords(*o);
+            }}
+        attrs = (EditorCharType*) malloc(nstates * sizeof(*attrs));
+        if(!attrs)
+            { fprintf(stdout, "failed to allocate the jsf state table\n"); return; }
+        {for(unsigned n=0; n<nstates; ++n)
+            attrs[n] = statelist[n]->attr;}
+        start = states ? states->index : 0;
+
+        // Bytes are in the same class if every state has the same option for them
+        unsigned char first[256]; // The first byte of each class
+        {for(unsigned c=0; c<256; ++c)
+        {
+            unsigned k = 0;
+            for(; k<nclasses; ++k)
+            {
+                unsigned n = 0;
+                while(n < nstates && statelist[n]->options[c] == statelist[n]->options[first[k]]) ++n;
+                if(n == nstates) break;
+            }
+            if(k == nclasses) first[nclasses++] = c;
+            byteclass[c] = k;
+        }}
+
+        unsigned long bytes = (unsigned long)nstates * nclasses * sizeof(transition);
+        if(bytes == (size_t)bytes) table = (transition*) malloc((size_t)bytes);
+        if(!table)
+            { fprintf(stdout, "failed to allocate the jsf transition table (%lu bytes)\n", bytes); return; }
+        {for(unsigned n=0; n<nstates; ++n)
+            for(unsigned k=0; k<nclasses; ++k)
+            {
+                const option* o = statelist[n]->options[first[k]];
+                transition&   t = table[n * nclasses + k];
+                if(!o || !o->name_mapped || !o->state)
+                {
+                    // Already reported by BindStates(); stay in the state
+                    t.state = n; t.recolor = 0; t.flags = 0;
+                    continue;
+                }
+                t.state   = o->state->index;
+                t.recolor = o->recolor;
+                t.flags   = (o->noeat       ? TrNoEat       : 0)
+                          | (o->buffer      ? TrBuffer      : 0)
+                          | (o->mark        ? TrMark        : 0)
+                          | (o->markend     ? TrMarkEnd     : 0)
+                          | (o->recolormark ? TrRecolorMark : 0)
+                          | (o->strings     ? TrStrings     : 0);
+            }}
+    }
+
+    /* Gives the state an index in statelist, unless it already has one */
+    bool AddState(state* s)
+    {
+        if(s->index < nstates && statelist[s->index] == s) return true;
+        if(nstates % 64 == 0)
+        {
+            state** l = nstates >= 0xFFFFu ? nullptr
+                      : (state**) realloc(statelist, (nstates + 64) * sizeof(*statelist));
+            if(!l)
+                { fprintf(stdout, "failed to allocate the jsf state table\n"); return false; }
+            statelist = l;
+        }
+        s->index = nstates;
+        statelist[nstates++] = s;
+        return true;
+    }
+
+    /* Makes a collision-free hash of the option's string table,
+     * so that Apply() can find a word with one hash and one compare.
+     * Like find_jsf_formula.cc, this tries seeds until nothing collides;
+     * but there is a seed for each bucket of two words or so, so that
+     * the slots can be nearly all filled. The largest buckets go first.
+     * If it fails, Apply() will use the binary search instead.
+     */
+    static void HashKeywords(option& o)
+    {
+        const TabType& tab = o.stringtable;
+        bool fold = o.strings == 2;
+        unsigned n = 0;
+        unsigned long*  hash  = (unsigned long*)  malloc((tab.size()+1) * sizeof(*hash));
+        state**         which = (state**)         malloc((tab.size()+1) * sizeof(*which));
+        unsigned short* token = (unsigned short*) malloc((tab.size()+1) * sizeof(*token));
+        if(!hash || !which || !token) goto fail;
+        // Duplicates are adjacent, since the table is sorted.
+        // Each word goes where the binary search would have taken it.
+        {for(unsigned k=0; k<tab.size() && k<0xFFFFu; ++k)
+        {
+            if(k > 0 && strcmp(tab[k].token, tab[k-1].token) == 0) continue;
+            which[n] = fold ? findstate_i(tab, tab[k].token) : findstate(tab, tab[k].token);
+            if(!which[n]) continue;
+            token[n]  = k;
+            hash[n++] = KeywordHash(tab[k].token, strlen(tab[k].token), fold);
+        }}
+        o.seedbits = 0; while((2u << o.seedbits) < n) ++o.seedbits;
+        o.keyseeds = (unsigned short*) malloc(sizeof(*o.keyseeds) << o.seedbits);
+        if(!o.keyseeds) goto fail;
+        for(o.keybits = 1; (1u << o.keybits) < n; ++o.keybits) {}
+        for(; o.keybits < 16; ++o.keybits)
+        {
+            unsigned mask = (1u << o.seedbits) - 1, size, b;
+            o.keywords = (keyword*) calloc(1u << o.keybits, sizeof(keyword));
+            if(!o.keywords) goto fail;
+            for(size = n; size > 0; --size)
+                for(b = 0; b <= mask; ++b)
+                {
+                    unsigned count = 0;
+                    {for(unsigned k=0; k<n; ++k) count += (hash[k] & mask) == b;}
+                    if(count != size) continue;
+                    unsigned long seed = 0;
+                    for(; seed <= 0xFFFFu; ++seed)
+                    {
+                        unsigned k = 0;
+                        for(; k<n; ++k)
+                        {
+                            if((hash[k] & mask) != b) continue;
+                            keyword& w = o.keywords[KeywordSlot(hash[k], seed, o.keybits)];
+                            if(w.token) break;
+                            w.token  = tab[token[k]].token;
+                            w.state  = which[k];
+                            w.length = strlen(w.token);
+                        }
+                        if(k == n) break;
+                        // Collided; take back what this seed placed
+                        while(k-- > 0)
+                            if((hash[k] & mask) == b)
+                            {
+                                keyword& w = o.keywords[KeywordSlot(hash[k], seed, o.keybits)];
+                                w.token  = nullptr;
+                                w.length = 0;
+                            }
+                    }
+                    if(seed > 0xFFFFu) goto bigger;
+                    o.keyseeds[b] = seed;
+                }
+            free(hash);
+            free(which);
+            free(token);
+            return;
+        bigger:
+            free(o.keywords);
+            o.keywords = nullptr;
+        }
+    fail:
+        fprintf(stdout, "failed to hash a string table of %u words\n", (unsigned)tab.size());
+        free(o.keywords); o.keywords = nullptr;
+        free(o.keyseeds); o.keyseeds = nullptr;
+        free(hash);
+        free(which);
+        free(token);
     }
 
     #if !(defined(__cplusplus) && __cplusplus >= 201100L)
@@ -652,6 +1032,8 @@ private:
         for(unsigned b=del_list.size(); b-- > 0; )
         {
             option* o = (option*) del_list[b].state;
+            free(o->keywords);
+            free(o->keyseeds);
             TabType& str = o->stringtable;
             for(unsigned c=str.size(); c-- > 0; )
                 if(str[c].token)
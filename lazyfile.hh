@@ -0,0 +1,235 @@
+/* Ad-hoc programming editor for DOSBox -- (C) 2011-03-08 Joel Yliluoma */
+#ifndef bqtLazyFileHH
+#define bqtLazyFileHH
+
+/* Loading a file lazily.
+ *
+ * Rather than converting the whole file into lines before anything
+ * is displayed, the file is first only indexed: for every leaf
+ * of the line tree (LineTreeType::LeafCap lines), the position
+ * in the file where its first line begins is recorded.
+ * The lines of a leaf are converted into cells only when
+ * something (rendering, highlighting, editing) actually needs them.
+ *
+ * The conversion is exactly the same as the one that FileLoad() does,
+ * including its handling of lone CRs (a CR that is not followed by LF
+ * ends the line), so a position is not just a byte offset:
+ * a line may also begin with a literal CR that was already read.
+ * A position is therefore encoded as offset*2 + literal_cr.
+ *
+ * The file must remain open and unchanged for as long as
+ * there are lines that have not been loaded yet. If it changes,
+ * Invalidate() stops the loading.
+ *
+ * #include "chartype.hh" before this file (for EditorCharVecType).
+ */
+
+#include <stdio.h>
+
+class LazyFileType
+{
+public:
+    typedef EditorCharVecType T;
+
+    /* Statistics */
+    unsigned long file_bytes; // Size of the file
+    unsigned long num_reads;  // Number of times Read() was called
+    unsigned long lines_read; // Number of lines converted by Read()
+
+public:
+    LazyFileType() : fp(0), tab(8), next(0), indexing(false), stale(false), buf_pos(0), buf_len(0), file_pos(0)
+    {
+        file_bytes = num_reads = lines_read = 0;
+    }
+    ~LazyFileType()
+    {
+        Close();
+    }
+
+    /* Takes ownership of fp, and begins indexing it from the start.
+     * A tabsize of 0 keeps the tabs as they are.
+     */
+    void Open(FILE* f, unsigned char tabsize)
+    {
+        Close();
+        fp       = f;
+        tab      = tabsize;
+        next     = 0;
+        indexing = true;
+        stale    = false;
+        buf_pos  = buf_len = 0;
+        fseek(fp, 0, SEEK_END);
+        file_bytes = ftell(fp);
+        rewind(fp);
+        file_pos   = 0;
+        num_reads  = lines_read = 0;
+    }
+    void Close()
+    {
+        if(fp) fclose(fp);
+        fp       = 0;
+        indexing = false;
+        stale    = false;
+    }
+
+    /* The file was changed while some of it was not loaded yet.
+     * Those lines can no longer be loaded: Read() leaves them empty
+     * from now on, and the indexing stops where it is.
+     */
+    void Invalidate()
+    {
+        Close();
+        stale = true;
+    }
+    /* Whether Invalidate() was called since Open() */
+    bool Stale() const { return stale; }
+
+    /* Whether some of the file has not been indexed yet */
+    bool Indexing() const { return indexing; }
+    /* How many bytes of the file have been indexed */
+    unsigned long Indexed() const { return indexing ? next >> 1 : file_bytes; }
+
+    /* Indexes the next group of up to max_lines lines.
+     * Returns the number of lines found, where they begin (for Read()),
+     * and the number of cells in them.
+     * At the end of the file, Indexing() becomes false.
+     */
+    unsigned Scan(unsigned max_lines, unsigned long& source, unsigned long& cells)
+    {
+        source = next;
+        cells  = 0;
+        unsigned n = Run(source, 0, max_lines, cells, next);
+        if(n < max_lines) indexing = false;
+        return n;
+    }
+
+    /* Converts count lines beginning from source into lines[0..count-1],
+     * which must be empty.
+     */
+    void Read(unsigned long source, T* lines, unsigned count)
+    {
+        if(!fp) return;
+        unsigned long cells = 0, after;
+        Run(source, lines, count, cells, after);
+        num_reads  += 1;
+        lines_read += count;
+    }
+
+private:
+    // Not copyable
+    LazyFileType(const LazyFileType&);
+    void operator=(const LazyFileType&);
+
+    int Byte(unsigned long pos)
+    {
+        if(pos < buf_pos || pos >= buf_pos + buf_len)
+        {
+            if(pos != file_pos) fseek(fp, (long)pos, SEEK_SET);
+            buf_pos  = pos;
+            buf_len  = fread(Buf, 1, sizeof(Buf), fp);
+            file_pos = pos + buf_len;
+            if(!buf_len) return -1;
+        }
+        return Buf[pos - buf_pos];
+    }
+
+    /* The FileLoad() state machine. Produces up to max_lines lines
+     * beginning from source, storing them in lines[] if it is nonzero.
+     * Returns the number of lines, and sets after to where the line
+     * that follows them begins.
+     */
+    unsigned Run(unsigned long source, T* lines, unsigned max_lines,
+                 unsigned long& cells, unsigned long& after)
+    {
+        unsigned long pos = source >> 1;
+        unsigned n   = 0;
+        size_t   len = 0; // Length of the current line
+        unsigned long cells_before = cells; // Cells before the current line
+        int hadnl = 1, got_cr = 0;
+        if(source & 1)
+        {
+            if(lines) lines[0].push_back( MakeUnknownColor('\r') );
+            ++cells;
+            len    = 1;
+            hadnl  = 0;
+            got_cr = 1;
+        }
+        int b;
+        while(n < max_lines && (b = Byte(pos)) >= 0)
+        {
+            ++pos;
+            if(b == '\r' && !got_cr) { got_cr = 1; continue; }
+            int maxrepeat = (got_cr && b != '\n') ? 2 : 1;
+            for(int repeat=0; repeat<maxrepeat; ++repeat)
+            {
+                unsigned char c = b;
+                if(repeat == 0 && got_cr) c = '\n';
+
+                if(c == '\t' && tab)
+                {
+                    size_t nextstop = len + tab;
+                    nextstop -= nextstop % tab;
+                    if(lines) lines[n].resize(nextstop, MakeUnknownColor(' '));
+                    cells += nextstop - len;
+                    len    = nextstop;
+                }
+                else
+                {
+                    if(lines) lines[n].push_back( MakeUnknownColor(c) );
+                    ++cells;
+                    ++len;
+                }
+
+                hadnl = 0;
+                if(c == '\n')
+                {
+                    len   = 0;
+                    hadnl = 1;
+                    cells_before = cells;
+                    if(++n == max_lines)
+                    {
+                        // If this byte was not consumed yet, the next line begins with it
+                        if(repeat+1 < maxrepeat)
+                            after = b == '\r' ? (pos << 1) | 1 : (pos-1) << 1;
+                        else
+                            after = pos << 1;
+                        return n;
+                    }
+                }
+            }
+            got_cr = b == '\r';
+        }
+        if(n < max_lines)
+        {
+            // The last line is only kept if the file ended in a newline
+            // (in which case it is empty). Otherwise it is dropped.
+            if(hadnl) ++n;
+            else
+            {
+                if(lines) lines[n].clear();
+                cells = cells_before;
+            }
+        }
+        after = pos << 1;
+        return n;
+    }
+
+private:
+    FILE*         fp;
+    unsigned char tab;
+    unsigned long next;     // Where the next Scan() begins
+    bool          indexing;
+    bool          stale;    // Invalidate() was called
+
+    unsigned char Buf[1024];
+    unsigned long buf_pos;  // File offset of Buf[0]
+    unsigned long buf_len;  // Number of valid bytes in Buf
+    unsigned long file_pos; // File offset of the stdio stream
+};
+
+#ifdef LAZY_LOAD
+/* The file that the editor buffer is being loaded from (defined in main.cc) */
+extern LazyFileType LazyFile;
+#endif
+
+#endif
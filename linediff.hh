@@ -0,0 +1,183 @@
+/* Ad-hoc programming editor for DOSBox -- (C) 2011-03-08 Joel Yliluoma */
+#ifndef bqtLineDiffHH
+#define bqtLineDiffHH
+
+/* Finding the lines that differ between two versions of a file.
+ *
+ * The lines are compared by their hashes, which the caller computes.
+ * The lines that are the same at the beginning and at the end are
+ * skipped first; usually, that leaves little. Between them, the
+ * shortest edit script is found with the O(ND) algorithm of Myers,
+ * where D is the number of lines that were added or removed.
+ * For each D it records how far along each diagonal it got,
+ * which takes D*D/2 numbers, so D is limited to MaxEdits. If the
+ * versions differ more than that, the lines between the common
+ * beginning and end are taken to have changed as a whole.
+ *
+ * The result is a list of hunks, in order: in each of them,
+ * lines a_begin..a_end-1 of the old version were replaced
+ * with lines b_begin..b_end-1 of the new version.
+ */
+
+#include <stdlib.h>
+
+class LineDiffType
+{
+public:
+    struct Hunk
+    {
+        size_t a_begin, a_end; // Lines in the old version
+        size_t b_begin, b_end; // Lines in the new version
+    };
+
+    /* Statistics */
+    unsigned long edits;   // D of the last Compute(), or ~0 if it gave up
+    unsigned long gave_up; // Number of times the versions differed too much
+
+public:
+    LineDiffType() : hunks(0), nhunks(0), caphunks(0), trace(0), captrace(0)
+    {
+        edits = gave_up = 0;
+    }
+    ~LineDiffType()
+    {
+        free(hunks);
+        free(trace);
+    }
+
+    /* Compares the old version a[0..na-1] with the new version b[0..nb-1].
+     * Returns false if there was not enough memory.
+     */
+    bool Compute(const unsigned long* a, size_t na, const unsigned long* b, size_t nb)
+    {
+        nhunks = 0;
+        edits  = 0;
+        size_t p = 0, s = 0;
+        while(p < na && p < nb && a[p] == b[p]) ++p;
+        while(s < na-p && s < nb-p && a[na-1-s] == b[nb-1-s]) ++s;
+        long n = (long)(na-p-s), m = (long)(nb-p-s);
+        if(n == 0 || m == 0)
+        {
+            edits = n + m;
+            return (n == 0 && m == 0) || Add(p, na-s, p, nb-s);
+        }
+        long d = Forward(a+p, n, b+p, m);
+        if(d < 0)
+        {
+            edits = ~0ul;
+            ++gave_up;
+            return Add(p, na-s, p, nb-s);
+        }
+        edits = d;
+        return Backward(d, n, m, p);
+    }
+
+    size_t size() const { return nhunks; }
+    const Hunk& operator[] (size_t n) const { return hunks[n]; }
+
+private:
+    // Not copyable
+    LineDiffType(const LineDiffType&);
+    void operator=(const LineDiffType&);
+
+  #ifdef __BORLANDC__
+    enum { MaxEdits = 100 };
+  #else
+    enum { MaxEdits = 2000 };
+  #endif
+
+    /* Where the furthest x on diagonal k (= x-y) for d edits is kept:
+     * the diagonals -d, -d+2, ..., d of each d follow each other.
+     */
+    static size_t Slot(long d, long k) { return (size_t)(d*(d+1)/2 + (k+d)/2); }
+
+    /* Finds the number of edits needed, or -1 if it is more than MaxEdits */
+    long Forward(const unsigned long* a, long n, const unsigned long* b, long m)
+    {
+        long maxd = n + m < MaxEdits ? n + m : (long)MaxEdits;
+        for(long d = 0; d <= maxd; ++d)
+        {
+            if(!Reserve(Slot(d+1, -(d+1)))) return -1;
+            for(long k = -d; k <= d; k += 2)
+            {
+                long x;
+                if(d == 0)
+                    x = 0;
+                else if(k == -d || (k != d && trace[Slot(d-1,k-1)] < trace[Slot(d-1,k+1)]))
+                    x = trace[Slot(d-1,k+1)];   // A line was added
+                else
+                    x = trace[Slot(d-1,k-1)]+1; // A line was removed
+                long y = x - k;
+                while(x < n && y < m && a[x] == b[y]) { ++x; ++y; }
+                trace[Slot(d,k)] = x;
+                if(x >= n && y >= m) return d;
+            }
+        }
+        return -1;
+    }
+
+    /* Goes back from the end along the path that Forward() found, and
+     * records the lines between the runs of equal lines as hunks.
+     * The hunks are found last first; they are reversed at the end.
+     */
+    bool Backward(long d, long n, long m, size_t p)
+    {
+        long x = n, y = m;
+        for(; d > 0; --d)
+        {
+            long k = x - y, prev_k;
+            if(k == -d || (k != d && trace[Slot(d-1,k-1)] < trace[Slot(d-1,k+1)]))
+                prev_k = k+1;
+            else
+                prev_k = k-1;
+            long prev_x = trace[Slot(d-1,prev_k)], prev_y = prev_x - prev_k;
+            // The equal lines after the edit
+            long run_x = prev_k == k+1 ? prev_x : prev_x+1;
+            long run   = x - run_x;
+            x -= run; y -= run;
+            // The edit, joined with the hunk after it if they touch
+            if(nhunks && hunks[nhunks-1].a_begin == p+x && hunks[nhunks-1].b_begin == p+y)
+                { hunks[nhunks-1].a_begin = p+prev_x; hunks[nhunks-1].b_begin = p+prev_y; }
+            else if(!Add(p+prev_x, p+x, p+prev_y, p+y))
+                return false;
+            x = prev_x; y = prev_y;
+        }
+        for(size_t i = 0, j = nhunks; i + 1 < j; ++i, --j)
+            { Hunk h = hunks[i]; hunks[i] = hunks[j-1]; hunks[j-1] = h; }
+        return true;
+    }
+
+    bool Add(size_t a_begin, size_t a_end, size_t b_begin, size_t b_end)
+    {
+        if(nhunks == caphunks)
+        {
+            size_t newcap = caphunks ? caphunks*2 : 16;
+            Hunk* h = (Hunk*) realloc(hunks, newcap * sizeof(Hunk));
+            if(!h) return false;
+            hunks    = h;
+            caphunks = newcap;
+        }
+        Hunk& h = hunks[nhunks++];
+        h.a_begin = a_begin; h.a_end = a_end;
+        h.b_begin = b_begin; h.b_end = b_end;
+        return true;
+    }
+    bool Reserve(size_t n)
+    {
+        if(n <= captrace) return true;
+        size_t newcap = n * 2;
+        long* t = (long*) realloc(trace, newcap * sizeof(long));
+        if(!t) return false;
+        trace    = t;
+        captrace = newcap;
+        return true;
+    }
+
+private:
+    Hunk*  hunks;
+    size_t nhunks, caphunks;
+    long*  trace;   // See Slot()
+    size_t captrace;
+};
+
+#endif
@@ -0,0 +1,294 @@
+/* Ad-hoc programming editor for DOSBox -- (C) 2011-03-08 Joel Yliluoma */
+#ifndef bqtLinePackHH
+#define bqtLinePackHH
+
+/* Compression of the leaves of the line tree (LineTreeType)
+ * that have not been used for a while.
+ *
+ * A leaf is packed into one block of memory: the lengths of its lines,
+ * then the character bytes of all cells, then the attribute bytes of
+ * all cells. Keeping the two apart lets the attributes, which come in
+ * long runs of the same syntax color, compress into almost nothing,
+ * and keeps the highlighting intact across packing and unpacking.
+ * The block is compressed with a simple LZ77 codec (Compress(),
+ * Decompress()) in the style of LZ4: no entropy coding, so it is fast
+ * enough to unpack a leaf while the user is paging through the file.
+ * Errors are reported in StatusLine. A leaf that could not be unpacked
+ * keeps its block.
+ *
+ * #include "chartype.hh" before this file (for EditorCharVecType).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h> // clock(), or uclock() in DJGPP
+
+/* The status line of the editor (defined in main.cc) */
+extern char StatusLine[256];
+
+class LinePackType
+{
+public:
+    typedef EditorCharVecType T;
+
+    unsigned long cold_seconds;   // Leaves that have not been used for this long are packed
+
+    /* Statistics */
+    unsigned long packed_leaves;  // Number of leaves that are packed now
+    unsigned long packed_bytes;   // Memory used by them
+    unsigned long expanded_bytes; // Memory that their cells would take
+    unsigned long num_packs;      // Number of times a leaf was packed
+    unsigned long num_unpacks;    // Number of times a leaf was unpacked
+    unsigned long unpack_ticks;   // Total time spent unpacking, in Ticks()
+    unsigned long unpack_max;     // Longest time spent unpacking one leaf
+    unsigned long unread_leaves;  // Leaves that could not be unpacked (yet)
+
+public:
+    LinePackType(unsigned long seconds) : cold_seconds(seconds)
+    {
+        packed_leaves = packed_bytes = expanded_bytes = 0;
+        num_packs = num_unpacks = unpack_ticks = unpack_max = 0;
+        unread_leaves = 0;
+    }
+
+    /* Packs count lines. Returns the packed block (to be given to Unpack()
+     * later), or 0 if there was not enough memory.
+     */
+    unsigned char* Pack(const T* lines, unsigned count)
+    {
+        unsigned long cells = 0;
+        {for(unsigned a=0; a<count; ++a) cells += lines[a].size();}
+        unsigned long raw_size = count * 5ul + cells * 2;
+        unsigned char* raw = (unsigned char*) malloc(raw_size ? raw_size : 1);
+        if(!raw) return 0;
+
+        // Line lengths, 7 bits at a time
+        unsigned long p = 0;
+        {for(unsigned a=0; a<count; ++a)
+        {
+            unsigned long len = lines[a].size();
+            while(len >= 0x80) { raw[p++] = (unsigned char)(len | 0x80); len >>= 7; }
+            raw[p++] = (unsigned char)len;
+        }}
+        // Characters, then attributes
+        unsigned char* chars = raw + p;
+        unsigned char* attrs = chars + cells;
+        {for(unsigned a=0; a<count; ++a)
+        {
+            const T& line = lines[a];
+            for(unsigned long b=0, n=line.size(); b<n; ++b)
+            {
+                EditorCharType ch = line[b];
+                *chars++ = (unsigned char)ch;
+                *attrs++ = (unsigned char)(ch >> 8);
+            }
+        }}
+        raw_size = p + cells * 2;
+
+        BlockHeader hdr;
+        hdr.raw_size = raw_size;
+        hdr.cells    = cells;
+        unsigned char* block = (unsigned char*) malloc(sizeof(hdr) + raw_size + raw_size/255 + 16);
+        if(!block) { free(raw); return 0; }
+        hdr.size = sizeof(hdr) + Compress(raw, raw_size, block + sizeof(hdr));
+        free(raw);
+        memcpy(block, &hdr, sizeof(hdr));
+        unsigned char* shrunk = (unsigned char*) realloc(block, hdr.size);
+        if(shrunk) block = shrunk;
+
+        packed_leaves  += 1;
+        packed_bytes   += hdr.size;
+        expanded_bytes += cells * sizeof(EditorCharType);
+        num_packs      += 1;
+        return block;
+    }
+
+    /* Unpacks the block into lines[0..count-1], which must be empty,
+     * and frees the block. Returns false if there was not enough memory,
+     * in which case the block is kept, and the lines are left empty.
+     */
+    bool Unpack(unsigned char* block, T* lines, unsigned count)
+    {
+        unsigned long begin = Ticks();
+        BlockHeader hdr;
+        memcpy(&hdr, block, sizeof(hdr));
+        unsigned char* raw = (unsigned char*) malloc(hdr.raw_size ? hdr.raw_size : 1);
+        if(!raw) { sprintf(StatusLine, "Not enough memory for unpacking lines"); return false; }
+        Decompress(block + sizeof(hdr), hdr.size - sizeof(hdr), raw);
+
+        unsigned long p = 0;
+        {for(unsigned a=0; a<count; ++a)
+        {
+            unsigned long len = 0;
+            for(unsigned shift=0; ; shift += 7)
+            {
+                unsigned char b = raw[p++];
+                len |= (unsigned long)(b & 0x7F) << shift;
+                if(!(b & 0x80)) break;
+            }
+            lines[a].resize(len);
+        }}
+        const unsigned char* chars = raw + p;
+        const unsigned char* attrs = chars + hdr.cells;
+        {for(unsigned a=0; a<count; ++a)
+        {
+            T& line = lines[a];
+            for(unsigned long b=0, n=line.size(); b<n; ++b)
+                line[b] = (EditorCharType)(*chars++ | (*attrs++ << 8));
+        }}
+        free(raw);
+        free(block);
+
+        Forget(hdr);
+        num_unpacks += 1;
+        unsigned long took = Ticks() - begin;
+        unpack_ticks += took;
+        if(took > unpack_max) unpack_max = took;
+        return true;
+    }
+
+    /* Frees a block without unpacking it */
+    void Discard(unsigned char* block)
+    {
+        BlockHeader hdr;
+        memcpy(&hdr, block, sizeof(hdr));
+        Forget(hdr);
+        free(block);
+    }
+
+    /* A clock for measuring the unpacking time */
+    static unsigned long Ticks()
+    {
+      #ifdef __DJGPP__
+        return (unsigned long) uclock();
+      #else
+        return (unsigned long) clock();
+      #endif
+    }
+    static unsigned long TicksPerSecond()
+    {
+      #ifdef __DJGPP__
+        return UCLOCKS_PER_SEC;
+      #else
+        return CLOCKS_PER_SEC;
+      #endif
+    }
+
+    /* The codec. The compressed data is a sequence of:
+     *   token:  high 4 bits = number of literals, low 4 bits = match length - MinMatch
+     *           (15 in either means that more of the number follows, in bytes
+     *            that are added to it until one that is not 255)
+     *   the literals
+     *   offset: how far back the match is, 2 bytes, low byte first
+     * The last sequence only has the token and the literals.
+     */
+    unsigned long Compress(const unsigned char* in, unsigned long n, unsigned char* out)
+    {
+        memset(table, 0, sizeof(table));
+        unsigned long pos = 0, lit = 0, o = 0;
+        while(pos + MinMatch <= n)
+        {
+            unsigned h    = Hash(in + pos);
+            unsigned long cand = table[h]; // Position + 1, or 0 if none
+            table[h] = pos + 1;
+            if(!cand || pos - (cand-1) > MaxOffset || memcmp(in + cand-1, in + pos, MinMatch))
+                { ++pos; continue; }
+
+            unsigned long m = cand-1, len = MinMatch;
+            while(pos + len < n && in[m + len] == in[pos + len]) ++len;
+
+            o = PutToken(out, o, pos - lit, len - MinMatch);
+            memcpy(out + o, in + lit, pos - lit); o += pos - lit;
+            out[o++] = (unsigned char)(pos - m);
+            out[o++] = (unsigned char)((pos - m) >> 8);
+            o = PutLength(out, o, len - MinMatch);
+            pos += len;
+            lit  = pos;
+        }
+        o = PutToken(out, o, n - lit, 0);
+        memcpy(out + o, in + lit, n - lit); o += n - lit;
+        return o;
+    }
+    static void Decompress(const unsigned char* in, unsigned long n, unsigned char* out)
+    {
+        const unsigned char* end = in + n;
+        while(in < end)
+        {
+            unsigned token = *in++;
+            unsigned long lit = token >> 4;
+            if(lit == 15) lit += GetLength(in);
+            memcpy(out, in, lit); out += lit; in += lit;
+            if(in >= end) break;
+
+            unsigned offset = in[0] | (in[1] << 8);
+            in += 2;
+            unsigned long len = token & 15;
+            if(len == 15) len += GetLength(in);
+            len += MinMatch;
+            // The match may overlap what is being written, so copy byte by byte
+            const unsigned char* m = out - offset;
+            while(len-- > 0) *out++ = *m++;
+        }
+    }
+
+private:
+    // Not copyable
+    LinePackType(const LinePackType&);
+    void operator=(const LinePackType&);
+
+    enum { MinMatch  = 4,
+           MaxOffset = 65535,
+           HashBits  = 12 };
+
+    /* At the beginning of each packed block */
+    struct BlockHeader
+    {
+        unsigned long raw_size; // Size before compression
+        unsigned long size;     // Size of the block, including this header
+        unsigned long cells;    // Number of cells in the lines
+    };
+    void Forget(const BlockHeader& hdr)
+    {
+        packed_leaves  -= 1;
+        packed_bytes   -= hdr.size;
+        expanded_bytes -= hdr.cells * sizeof(EditorCharType);
+    }
+
+    static unsigned Hash(const unsigned char* p)
+    {
+        unsigned long v = p[0] | (p[1] << 8) | ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+        return (unsigned)(((v * 2654435761ul) & 0xFFFFFFFFul) >> (32 - HashBits));
+    }
+    static unsigned long PutToken(unsigned char* out, unsigned long o, unsigned long lit, unsigned long len)
+    {
+        out[o++] = (unsigned char)(((lit < 15 ? lit : 15) << 4) | (len < 15 ? len : 15));
+        return PutLength(out, o, lit);
+    }
+    /* Writes the rest of a number that did not fit in its 4 bits */
+    static unsigned long PutLength(unsigned char* out, unsigned long o, unsigned long value)
+    {
+        if(value < 15) return o;
+        value -= 15;
+        while(value >= 255) { out[o++] = 255; value -= 255; }
+        out[o++] = (unsigned char)value;
+        return o;
+    }
+    static unsigned long GetLength(const unsigned char*& in)
+    {
+        unsigned long value = 0;
+        unsigned char b;
+        do value += (b = *in++); while(b == 255);
+        return value;
+    }
+
+private:
+    unsigned long table[1u << HashBits]; // Where each hash was last seen
+};
+
+#ifdef LINE_COMPRESS
+/* The compression of the editor buffer (defined in main.cc) */
+extern LinePackType LinePack;
+#endif
+
+#endif
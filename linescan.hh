@@ -0,0 +1,218 @@
+/* Ad-hoc programming editor for DOSBox -- (C) 2011-03-08 Joel Yliluoma */
+#ifndef bqtLineScanHH
+#define bqtLineScanHH
+
+/* Helpers for converting the bytes of a file into cells quickly.
+ *
+ * FindLineSpecial() finds the next byte that FileLoad() cannot simply
+ * copy: a newline, a CR or a tab. Everything before it becomes cells
+ * as is, which AppendUnknownColor() does in bulk.
+ *
+ * Both use SSE2 (or AVX2) when the compiler is told that the CPU has it
+ * (e.g. -msse2, which is the default for x86_64). Otherwise, such as
+ * in the DJGPP build for 386, FindLineSpecial() looks at a machine word
+ * at a time instead.
+ *
+ * LineLoadType does the whole conversion with them. With UTF8_FILES,
+ * it first converts the UTF-8 of the file into CP437 (see utf8conv.hh).
+ *
+ * #include "chartype.hh" before this file (for EditorCharVecType).
+ */
+
+#include <string.h>
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+# include <immintrin.h>
+#endif
+#ifdef UTF8_FILES
+# include "utf8conv.hh"
+#endif
+
+/* Returns the index of the first '\n', '\r' or '\t' in p[0..n-1], or n if none */
+static size_t FindLineSpecial(const unsigned char* p, size_t n)
+{
+    size_t a = 0;
+#ifdef __AVX2__
+    {const __m256i nl = _mm256_set1_epi8('\n'), cr = _mm256_set1_epi8('\r'), tab = _mm256_set1_epi8('\t');
+    for(; a+32 <= n; a += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p+a));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, nl), _mm256_cmpeq_epi8(v, cr)),
+                            _mm256_cmpeq_epi8(v, tab)));
+        if(mask) return a + __builtin_ctz(mask);
+    }}
+#endif
+#ifdef __SSE2__
+    {const __m128i nl = _mm_set1_epi8('\n'), cr = _mm_set1_epi8('\r'), tab = _mm_set1_epi8('\t');
+    for(; a+16 <= n; a += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p+a));
+        unsigned mask = (unsigned)_mm_movemask_epi8(
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, nl), _mm_cmpeq_epi8(v, cr)),
+                         _mm_cmpeq_epi8(v, tab)));
+        if(mask) return a + __builtin_ctz(mask);
+    }}
+#else
+    // A word at a time: a byte of (w ^ c*ones) is zero where w has c.
+    // HasZero() may also flag a byte after a real zero, but not
+    // without one, so the bytes of a flagged word are checked one by one.
+    {const unsigned long ones = ~0ul / 255, high = ones << 7;
+    #define HasZero(w) (((w) - ones) & ~(w) & high)
+    for(; a+sizeof(unsigned long) <= n; a += sizeof(unsigned long))
+    {
+        unsigned long w;
+        memcpy(&w, p+a, sizeof(w));
+        if(HasZero(w ^ (ones*'\n')) | HasZero(w ^ (ones*'\r')) | HasZero(w ^ (ones*'\t')))
+            break;
+    }
+    #undef HasZero
+    }
+#endif
+    for(; a<n; ++a)
+        if(p[a] == '\n' || p[a] == '\r' || p[a] == '\t')
+            break;
+    return a;
+}
+
+/* Appends p[0..n-1] to the line, each with MakeUnknownColor() */
+static void AppendUnknownColor(EditorCharVecType& line, const unsigned char* p, size_t n)
+{
+    if(!n) return;
+    size_t old = line.size();
+    if(line.capacity() < old + n) line.reserve((old + n) * 2);
+    line.resize(old + n);
+    // A vector that was just resized is contiguous (see gapbase.hh)
+    EditorCharType* d = &line[old];
+    size_t a = 0;
+#ifdef __SSE2__
+    // Interleave the characters with the attribute bytes, 16 at a time
+    {const __m128i attr = _mm_set1_epi8((char)(MakeUnknownColor(0) >> 8));
+    for(; a+16 <= n; a += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p+a));
+        _mm_storeu_si128((__m128i*)(d+a),   _mm_unpacklo_epi8(v, attr));
+        _mm_storeu_si128((__m128i*)(d+a+8), _mm_unpackhi_epi8(v, attr));
+    }}
+#endif
+    for(; a<n; ++a)
+        d[a] = MakeUnknownColor(p[a]);
+}
+
+/* The conversion of the bytes of a file into lines that FileLoad() does.
+ *
+ * Each line ends in its '\n', and tabs are expanded into spaces
+ * (unless the tabsize is 0, in which case they are kept as they are).
+ * A CR followed by LF is just a newline. A lone CR is also a newline,
+ * but if the next byte is a CR as well, that CR is kept in the next line
+ * as a character (and still ends it, unless LF follows). The last line
+ * is only kept if the file ended in a newline, in which case it is empty.
+ *
+ * Feed() the file in pieces of any size, then call Finish().
+ * The lines are given to out.push_back() (e.g. a LineTreeType).
+ * After a LF, the state is always the same as at the beginning of the file,
+ * so the file can also be converted in parts that begin after a LF.
+ */
+class LineLoadType
+{
+public:
+    LineLoadType(unsigned char tabsize) : tab(tabsize), hadnl(1), got_cr(0) { }
+
+    template<typename Out>
+    void Feed(const unsigned char* Buf, size_t r, Out& out)
+    {
+      #ifdef UTF8_FILES
+        for(size_t a=0; a<r; )
+        {
+            // ASCII needs no conversion; the rest goes through conv
+            size_t plain = utf8.Plain(Buf+a, r-a);
+            if(plain) { FeedBytes(Buf+a, plain, out); a += plain; continue; }
+            size_t k = r-a < (size_t)ConvChunk ? r-a : (size_t)ConvChunk;
+            FeedBytes(conv, utf8.Decode(Buf+a, k, conv), out);
+            a += k;
+        }
+      #else
+        FeedBytes(Buf, r, out);
+      #endif
+    }
+
+    /* With keep_last, the last line is given even if the file
+     * did not end in a newline (for inserting the file into a line).
+     */
+    template<typename Out>
+    void Finish(Out& out, bool keep_last = false)
+    {
+      #ifdef UTF8_FILES
+        FeedBytes(conv, utf8.Finish(conv), out);
+      #endif
+        if(hadnl || keep_last) out.push_back(line);
+        line.clear();
+        hadnl  = 1;
+        got_cr = 0;
+    }
+
+private:
+    template<typename Out>
+    void FeedBytes(const unsigned char* Buf, size_t r, Out& out)
+    {
+        for(size_t a=0; a<r; ++a)
+        {
+            if(!got_cr)
+            {
+                // Everything up to the next newline, CR or tab is copied as is
+                size_t plain = FindLineSpecial(Buf+a, r-a);
+                if(plain)
+                {
+                    AppendUnknownColor(line, Buf+a, plain);
+                    hadnl = 0;
+                    a += plain;
+                    if(a == r) break;
+                }
+            }
+            if(Buf[a] == '\r' && !got_cr) { got_cr = 1; continue; }
+            int maxrepeat = (got_cr && Buf[a] != '\n') ? 2 : 1;
+            for(int repeat=0; repeat<maxrepeat; ++repeat)
+            {
+                unsigned char c = Buf[a];
+                if(repeat == 0 && got_cr) c = '\n';
+
+                if(c == '\t' && tab)
+                {
+                    size_t nextstop = line.size() + tab;
+                    nextstop -= nextstop % tab;
+                    line.resize(nextstop, MakeUnknownColor(' '));
+                }
+                else
+                    line.push_back( MakeUnknownColor(c) );
+
+                hadnl = 0;
+                if(c == '\n')
+                {
+                    out.push_back(line);
+                    line.clear();
+                    hadnl = 1;
+                }
+            }
+            got_cr = Buf[a] == '\r';
+        }
+    }
+
+private:
+    EditorCharVecType line;   // The line being converted
+    unsigned char     tab;
+    int               hadnl;  // Whether the line is empty after a newline
+    int               got_cr; // Whether the previous byte was a CR
+  #ifdef UTF8_FILES
+  #ifdef __BORLANDC__
+    enum { ConvChunk = 256 };
+  #else
+    enum { ConvChunk = 4096 };
+  #endif
+    Utf8DecodeType    utf8;
+    unsigned char     conv[ConvChunk*2 + 8]; // The file converted into CP437
+  #endif
+};
+
+#endif
@@ -0,0 +1,1149 @@
+/* Ad-hoc programming editor for DOSBox -- (C) 2011-03-08 Joel Yliluoma */
+#ifndef bqtLineTreeHH
+#define bqtLineTreeHH
+
+/* A balanced tree (B+tree) of editor lines, indexed by line number.
+ *
+ * The lines are stored in leaves of at most LeafCap lines each,
+ * and each internal node records how many lines are within each
+ * of its children. Inserting or deleting a line therefore only
+ * shifts the lines within one leaf, rather than every line that
+ * follows it in the file. Lookup, insert and erase are O(log n).
+ *
+ * The most recently used leaf is remembered (the "finger"),
+ * so that sequential access (rendering, syntax highlighting)
+ * costs O(1) per line rather than O(log n).
+ *
+ * Unused slots in a leaf are always empty vectors.
+ * Lines are moved between slots with swap(), never copied.
+ *
+ * #include "chartype.hh" before this file (for EditorCharVecType).
+ *
+ * Each node also records how many cells are within each of its children,
+ * so that a line number can be converted into the offset of its first cell
+ * in the whole buffer and back in O(log n) (OffsetOf(), LineAt()).
+ * Whoever changes the length of a line must call Changed() afterwards.
+ *
+ * With LAZY_LOAD, a leaf may also be just a reference to a range of
+ * lines in LazyFile (lazyfile.hh) that have not been loaded yet.
+ * They are loaded when any of them is accessed. AppendLazy() adds such leaves.
+ *
+ * With LINE_PAGING, the leaves that are in memory are kept in
+ * a most-recently-used-first list. When they take more memory than
+ * PageFile.limit, the least recently used ones are written into
+ * the swap file (pagefile.hh) and read back when accessed again.
+ * The MinResident most recently used leaves always stay in memory,
+ * so that references to lines remain valid while the caller
+ * accesses a few more lines (e.g. when joining two lines).
+ *
+ * With LINE_SNAPSHOTS, Snapshot() makes a copy of the tree in O(1),
+ * by letting both trees share the same nodes and leaves. Each node
+ * and leaf has a reference count, and is copied (copy-on-write) when
+ * either tree is about to modify it while it is shared. A snapshot is
+ * therefore a consistent version of the buffer that stays the same
+ * while the buffer is edited, and the unchanged leaves (and the lines
+ * within them) are shared between the two. Only the path from the root
+ * to the modified leaf is copied. Read a snapshot through a const
+ * reference, so that reading does not copy anything.
+ * Snapshots do not work together with LINE_PAGING.
+ *
+ * With LINE_COMPRESS, the leaves that are in memory are also kept in
+ * the most-recently-used-first list, and PackCold() compresses the ones
+ * that have not been used for LinePack.cold_seconds (linepack.hh).
+ * They are unpacked when accessed again, like the leaves that were paged
+ * out. Compressed leaves do not count as loaded(), so that highlighting
+ * the rest of the file does not unpack them all again.
+ * A leaf that could not be read back or unpacked gets empty stand-in
+ * lines, and is tried again when it is next accessed (see Reread()).
+ * Not together with LINE_SNAPSHOTS either.
+ */
+
+#ifdef LAZY_LOAD
+# include "lazyfile.hh"
+#endif
+#ifdef LINE_PAGING
+# include "pagefile.hh"
+#endif
+#ifdef LINE_COMPRESS
+# include "linepack.hh"
+#endif
+#if defined(LAZY_LOAD) || defined(LINE_PAGING) || defined(LINE_COMPRESS)
+# define LINETREE_ON_DEMAND // The lines of a leaf may be out of memory
+#endif
+#if defined(LINE_PAGING) || defined(LINE_COMPRESS)
+# define LINETREE_LRU       // The leaves in memory are listed in the order of use
+#endif
+#if defined(LINE_SNAPSHOTS) && defined(LINE_PAGING)
+# error LINE_SNAPSHOTS cannot be used with LINE_PAGING
+#endif
+#if defined(LINE_SNAPSHOTS) && defined(LINE_COMPRESS)
+# error LINE_SNAPSHOTS cannot be used with LINE_COMPRESS
+#endif
+
+class LineTreeType
+{
+public:
+    typedef EditorCharVecType value_type;
+    typedef EditorCharVecType T;
+    typedef size_t            size_type;
+
+    enum { LeafCap = 64, NodeCap = 32 };
+  #ifdef LINE_PAGING
+    enum { MinResident = 8 };
+  #endif
+
+private:
+    struct Leaf
+    {
+        unsigned count;
+        unsigned long cells; // Total length of the lines
+      #ifdef LINE_SNAPSHOTS
+        unsigned refs; // Number of trees and nodes that point to this leaf
+      #endif
+      #ifdef LINETREE_ON_DEMAND
+        T*            lines;  // LeafCap lines, or 0 if not in memory
+        unsigned long source; // Where LazyFile has the lines
+      #else
+        T        lines[LeafCap];
+      #endif
+      #ifdef LINE_PAGING
+        unsigned long swap_pos, swap_size; // Where PageFile has them, if swap_size != 0
+        unsigned long bytes;               // Memory used, as last measured
+      #endif
+      #ifdef LINETREE_LRU
+        unsigned      unread;              // If nonzero, lines are empty stand-ins for
+                                           // this many lines that could not be read back
+      #endif
+      #ifdef LINE_COMPRESS
+        unsigned char* packed;             // The lines compressed by LinePack, or 0
+        unsigned long  used;               // When the leaf was last used, in seconds
+      #endif
+      #ifdef LINETREE_LRU
+        Leaf*         newer;               // Neighbours in the list of leaves in memory
+        Leaf*         older;
+      #endif
+    };
+    struct Node
+    {
+        unsigned  count;
+      #ifdef LINE_SNAPSHOTS
+        unsigned  refs;
+      #endif
+        size_type sizes[NodeCap]; // Number of lines in each child
+        unsigned long cells[NodeCap]; // Number of cells in each child
+        void*     child[NodeCap]; // Node* or Leaf*, depending on level
+    };
+
+public:
+    LineTreeType() : root(0), height(0), total(0), finger(0), finger_first(0)
+  #ifdef LINE_SNAPSHOTS
+                   , rfinger(0), rfinger_first(0)
+  #endif
+  #ifdef LINETREE_LRU
+                   , newest(0), oldest(0)
+  #endif
+  #ifdef LINE_COMPRESS
+                   , stamp(0)
+  #endif
+    { }
+    ~LineTreeType() { clear(); }
+
+    size_type size() const { return total; }
+    int empty() const { return total == 0; }
+    /* Total length of all lines */
+    unsigned long cells() const { return root ? SubtreeCells(root, height) : 0; }
+
+    T& operator[] (size_type index)
+    {
+        if(finger && index - finger_first < finger->count)
+            return finger->lines[index - finger_first];
+        return Locate(index);
+    }
+    const T& operator[] (size_type index) const
+    {
+      #ifdef LINE_SNAPSHOTS
+        // Reading must not copy anything that is shared,
+        // so this has a finger of its own
+        LineTreeType* t = (LineTreeType*)this;
+        if(!t->rfinger || index - rfinger_first >= rfinger->count)
+        {
+            size_type i = index;
+            t->rfinger = Find(i, t->rfinger_first);
+            t->Load(rfinger);
+        }
+        return rfinger->lines[index - rfinger_first];
+      #else
+        return (*(LineTreeType*)this)[index];
+      #endif
+    }
+    T& front() { return (*this)[0]; }
+    T& back()  { return (*this)[total-1]; }
+
+    void push_back(const T& line)
+    {
+        insert(total, line);
+    }
+
+    void insert(size_type pos, const T& line)
+    {
+        ResetFingers();
+        if(!root) { root = NewLeaf(); height = 0; }
+        root = Unshare(root, height);
+        size_type split_size = 0;
+        void* split = InsertRec(root, height, pos, line, split_size);
+        ++total;
+        if(split) GrowRoot(split, split_size);
+    }
+    void insert(size_type pos, size_type count, const T& line)
+    {
+        for(size_type a=0; a<count; ++a)
+            insert(pos+a, line);
+    }
+
+    void erase(size_type pos)
+    {
+        ResetFingers();
+        root = Unshare(root, height);
+        EraseRec(root, height, pos);
+        --total;
+        // Shrink the tree if the root has only one child
+        while(height > 0 && ((Node*)root)->count == 1)
+        {
+            Node* n = (Node*)root;
+            root = n->child[0];
+            --height;
+            delete n;
+        }
+    }
+    void erase(size_type first, size_type last)
+    {
+        for(size_type n = last-first; n > 0; --n)
+            erase(first);
+    }
+
+    /* Updates the cell counts after the length of the line has changed */
+    void Changed(size_type index)
+    {
+        size_type i = index, first;
+        Leaf* l = Find(i, first);
+        Load(l);
+        unsigned long cells = 0;
+        for(unsigned a=0; a<l->count; ++a) cells += l->lines[a].size();
+        long delta = (long)(cells - l->cells);
+        if(!delta) return;
+
+        void** p = &root;
+        for(unsigned h=height; h>0; --h)
+        {
+            Node* n = (Node*)(*p = Unshare(*p, h));
+            unsigned c = 0;
+            while(c+1 < n->count && index >= n->sizes[c])
+                { index -= n->sizes[c]; ++c; }
+            n->cells[c] += delta;
+            p = &n->child[c];
+        }
+        l = (Leaf*)(*p = Unshare(*p, 0));
+        l->cells = cells;
+    }
+    /* Returns the number of cells before the line.
+     * index may also be size(), which gives the total.
+     */
+    unsigned long OffsetOf(size_type index) const
+    {
+        if(!root) return 0;
+        unsigned long offset = 0;
+        const void* p = root;
+        for(unsigned h=height; h>0; --h)
+        {
+            const Node* n = (const Node*)p;
+            unsigned c = 0;
+            while(c+1 < n->count && index >= n->sizes[c])
+                { index -= n->sizes[c]; offset += n->cells[c]; ++c; }
+            p = n->child[c];
+        }
+        Leaf* l = (Leaf*)p;
+        ((LineTreeType*)this)->Load(l);
+        for(unsigned a=0; a<index && a<l->count; ++a)
+            offset += l->lines[a].size();
+        return offset;
+    }
+    /* Returns the line that has the cell at the given offset,
+     * and sets column to its position within that line.
+     * Offsets past the end give the end of the last line.
+     */
+    size_type LineAt(unsigned long offset, size_type& column) const
+    {
+        column = 0;
+        if(!root) return 0;
+        size_type first = 0;
+        const void* p = root;
+        for(unsigned h=height; h>0; --h)
+        {
+            const Node* n = (const Node*)p;
+            unsigned c = 0;
+            while(c+1 < n->count && offset >= n->cells[c])
+                { offset -= n->cells[c]; first += n->sizes[c]; ++c; }
+            p = n->child[c];
+        }
+        Leaf* l = (Leaf*)p;
+        ((LineTreeType*)this)->Load(l);
+        unsigned a = 0;
+        while(a+1 < l->count && offset >= l->lines[a].size())
+            offset -= l->lines[a++].size();
+        column = offset < l->lines[a].size() ? (size_type)offset : l->lines[a].size();
+        return first + a;
+    }
+
+    void clear()
+    {
+        if(root) DeleteRec(root, height);
+        root   = 0;
+        height = 0;
+        total  = 0;
+        ResetFingers();
+      #ifdef LINETREE_LRU
+        newest = oldest = 0;
+      #endif
+      #ifdef LINE_PAGING
+        // Nothing refers to the swap file anymore
+        PageFile.resident_bytes = PageFile.resident_leaves = 0;
+        PageFile.Close();
+      #endif
+    }
+  #ifdef LAZY_LOAD
+    /* Appends count lines that begin from source in LazyFile.
+     * They are loaded only when needed. cells is their total length.
+     */
+    void AppendLazy(unsigned long source, unsigned count, unsigned long cells)
+    {
+        if(!count) return;
+        if(!total) clear();
+        Leaf* l = new Leaf;
+        l->count  = count;
+        l->cells  = cells;
+        l->lines  = 0;
+        l->source = source;
+      #ifdef LINE_SNAPSHOTS
+        l->refs   = 1;
+      #endif
+      #ifdef LINE_PAGING
+        l->swap_pos = l->swap_size = 0;
+        l->bytes    = 0;
+      #endif
+      #ifdef LINETREE_LRU
+        l->unread   = 0;
+      #endif
+      #ifdef LINE_COMPRESS
+        l->packed   = 0;
+      #endif
+        AppendLeaf(l);
+    }
+    /* Loads all lines that have not been loaded yet */
+    void LoadAll()
+    {
+        if(root) LoadRec(root, height);
+    }
+    /* Whether some lines have not been loaded from LazyFile yet */
+    bool LazyLeft() const
+    {
+        return root && LazyLeftRec(root, height);
+    }
+  #endif
+  #if defined(LAZY_LOAD) || defined(LINE_COMPRESS)
+    /* Whether the line has been loaded from LazyFile, and is not
+     * compressed. It may have been paged out since.
+     */
+    bool loaded(size_type index) const
+    {
+        if(finger && index - finger_first < finger->count) return true;
+        size_type first;
+        Leaf* l = Find(index, first);
+      #ifdef LINE_COMPRESS
+        if(l->packed) return false;
+      #endif
+      #ifdef LINE_PAGING
+        if(l->swap_size) return true;
+      #endif
+        return l->lines != 0;
+    }
+  #endif
+  #ifdef LINE_COMPRESS
+    /* Compresses the leaves that have not been used for LinePack.cold_seconds,
+     * at most max_leaves of them. now is the current time in seconds.
+     * Returns true if there are more to compress.
+     */
+    bool PackCold(unsigned long now, unsigned max_leaves)
+    {
+        stamp = now;
+        // The finger is used without Load(), so it may look older than it is
+        if(finger) Touch(finger);
+        while(oldest && oldest != finger && now - oldest->used >= LinePack.cold_seconds)
+        {
+            if(!max_leaves--) return true;
+            Leaf* l = oldest;
+            unsigned char* packed = LinePack.Pack(l->lines, l->count);
+            if(!packed) break;
+            Unlink(l);
+            delete[] l->lines;
+            l->lines  = 0;
+            l->packed = packed;
+        }
+        return false;
+    }
+  #endif
+  #ifdef LINE_SNAPSHOTS
+    /* Makes into a copy of this tree, in O(1) time.
+     * The two share everything until either is modified.
+     */
+    void Snapshot(LineTreeType& into)
+    {
+        into.clear();
+        into.root   = root;
+        into.height = height;
+        into.total  = total;
+        if(root) ++Refs(root, height);
+        // The finger must always point to a leaf that is not shared
+        finger = 0;
+    }
+  #endif
+    /* Moves all lines of other to the end of this tree, leaving other empty.
+     * The leaves are moved as they are, so this takes O(leaves) time.
+     * other must not have snapshots (LINE_SNAPSHOTS).
+     */
+    void Splice(LineTreeType& other)
+    {
+        if(!other.root) return;
+        ResetFingers();
+        if(!total && root) { DeleteRec(root, height); root = 0; height = 0; }
+        SpliceRec(other, other.root, other.height);
+        other.root   = 0;
+        other.height = 0;
+        other.total  = 0;
+        other.ResetFingers();
+    }
+  #ifdef LINETREE_ON_DEMAND
+    /* Whether the line is in memory */
+    bool resident(size_type index) const
+    {
+        if(finger && index - finger_first < finger->count) return true;
+        size_type first;
+        return Find(index, first)->lines != 0;
+    }
+  #endif
+  #ifdef LINE_ARENA
+    /* Like clear(), but the lines are forgotten rather than freed.
+     * For use right before LineArena.ReleaseAll().
+     */
+    void forget()
+    {
+        if(root) ForgetRec(root, height);
+        clear();
+    }
+  #endif
+
+private:
+    // Not copyable
+    LineTreeType(const LineTreeType&);
+    void operator=(const LineTreeType&);
+
+    void ResetFingers()
+    {
+        finger  = 0;
+      #ifdef LINE_SNAPSHOTS
+        rfinger = 0;
+      #endif
+    }
+
+    /* Finds the leaf that has the given line. Changes index to be relative
+     * to that leaf, and sets first to the index of its first line.
+     */
+    Leaf* Find(size_type& index, size_type& first) const
+    {
+        void* p = root;
+        first = 0;
+        for(unsigned h=height; h>0; --h)
+        {
+            Node* n = (Node*)p;
+            unsigned c = 0;
+            while(c+1 < n->count && index >= n->sizes[c])
+                { index -= n->sizes[c]; first += n->sizes[c]; ++c; }
+            p = n->child[c];
+        }
+        return (Leaf*)p;
+    }
+    T& Locate(size_type index)
+    {
+        size_type first;
+      #ifdef LINE_SNAPSHOTS
+        Leaf* l = FindUnshared(index, first);
+      #else
+        Leaf* l = Find(index, first);
+      #endif
+        Load(l);
+        finger       = l;
+        finger_first = first;
+        return l->lines[index];
+    }
+
+  #ifdef LINE_SNAPSHOTS
+    /* Like Find(), but makes sure that nothing on the way is shared */
+    Leaf* FindUnshared(size_type& index, size_type& first)
+    {
+        void** p = &root;
+        first = 0;
+        for(unsigned h=height; ; --h)
+        {
+            *p = Unshare(*p, h);
+            if(h == 0) break;
+            Node* n = (Node*)*p;
+            unsigned c = 0;
+            while(c+1 < n->count && index >= n->sizes[c])
+                { index -= n->sizes[c]; first += n->sizes[c]; ++c; }
+            p = &n->child[c];
+        }
+        return (Leaf*)*p;
+    }
+    static unsigned& Refs(void* p, unsigned h)
+    {
+        return h == 0 ? ((Leaf*)p)->refs : ((Node*)p)->refs;
+    }
+  #endif
+    /* If the node or leaf p (at level h) is shared with another tree,
+     * replaces it with a copy of its own. Returns the copy.
+     */
+    void* Unshare(void* p, unsigned h)
+    {
+      #ifdef LINE_SNAPSHOTS
+        if(Refs(p, h) == 1) return p;
+        // The const reader may have been looking at the old one
+        rfinger = 0;
+        --Refs(p, h);
+        if(h == 0)
+        {
+            Leaf* l = (Leaf*)p;
+            Leaf* r = NewLeaf();
+            r->count = l->count;
+            r->cells = l->cells;
+          #ifdef LAZY_LOAD
+            if(!l->lines)
+            {
+                // Not loaded yet; share the place in the file instead
+                delete[] r->lines;
+                r->lines  = 0;
+                r->source = l->source;
+                return r;
+            }
+          #endif
+            for(unsigned a=0; a<l->count; ++a) r->lines[a] = l->lines[a];
+            return r;
+        }
+        Node* n = (Node*)p;
+        Node* r = NewNode();
+        r->count = n->count;
+        for(unsigned c=0; c<n->count; ++c)
+        {
+            r->sizes[c] = n->sizes[c];
+            r->cells[c] = n->cells[c];
+            r->child[c] = n->child[c];
+            ++Refs(r->child[c], h-1);
+        }
+        return r;
+      #else
+        (void)h;
+        return p;
+      #endif
+    }
+
+    static Node* NewNode()
+    {
+        Node* n = new Node;
+        n->count = 0;
+      #ifdef LINE_SNAPSHOTS
+        n->refs  = 1;
+      #endif
+        return n;
+    }
+    Leaf* NewLeaf()
+    {
+        Leaf* l = new Leaf;
+        l->count = 0;
+        l->cells = 0;
+      #ifdef LINE_SNAPSHOTS
+        l->refs  = 1;
+      #endif
+      #ifdef LINETREE_ON_DEMAND
+        l->lines = new T[LeafCap];
+      #endif
+      #ifdef LINE_PAGING
+        l->swap_pos = l->swap_size = 0;
+        l->bytes    = 0;
+      #endif
+      #ifdef LINETREE_LRU
+        l->unread   = 0;
+      #endif
+      #ifdef LINE_COMPRESS
+        l->packed   = 0;
+      #endif
+      #ifdef LINETREE_LRU
+        Link(l);
+      #endif
+      #ifdef LINE_PAGING
+        Trim();
+      #endif
+        return l;
+    }
+    void DeleteLeaf(Leaf* l)
+    {
+      #ifdef LINETREE_LRU
+        if(l->unread) UnreadLeaves(l) -= 1;
+        else if(l->lines) Unlink(l);
+      #endif
+      #ifdef LINE_COMPRESS
+        if(l->packed) LinePack.Discard(l->packed);
+      #endif
+      #ifdef LINETREE_ON_DEMAND
+        delete[] l->lines;
+      #endif
+        delete l;
+    }
+    /* Makes sure the lines of the leaf are in memory */
+    void Load(Leaf* l)
+    {
+      #ifdef LINETREE_ON_DEMAND
+      #ifdef LINETREE_LRU
+        if(l->unread) { Reread(l); return; }
+      #endif
+        if(l->lines)
+        {
+          #ifdef LINE_PAGING
+            PageFile.hits += 1;
+          #endif
+          #ifdef LINETREE_LRU
+            Touch(l);
+          #endif
+            return;
+        }
+        l->lines = new T[LeafCap];
+      #ifdef LINE_PAGING
+        PageFile.misses += 1;
+      #endif
+      #ifdef LINE_COMPRESS
+        if(l->packed)
+        {
+            if(!LinePack.Unpack(l->packed, l->lines, l->count))
+            {
+                // Give empty lines for now, but keep the block,
+                // and try again when the leaf is next accessed
+                l->unread = l->count;
+                LinePack.unread_leaves += 1;
+                return;
+            }
+            l->packed = 0;
+        }
+        else
+      #endif
+      #ifdef LINE_PAGING
+        if(l->swap_size)
+        {
+            if(!PageFile.Read(l->swap_pos, l->lines, l->count))
+            {
+                // Give empty lines for now, but keep the page,
+                // and try again when the leaf is next accessed
+                l->unread = l->count;
+                PageFile.unread_leaves += 1;
+                return;
+            }
+        }
+        else
+      #endif
+        {
+          #ifdef LAZY_LOAD
+            LazyFile.Read(l->source, l->lines, l->count);
+          #endif
+        }
+      #ifdef LINETREE_LRU
+        Link(l);
+      #endif
+      #ifdef LINE_PAGING
+        Measure(l);
+        Trim();
+      #endif
+      #else
+        (void)l;
+      #endif
+    }
+  #ifdef LINETREE_LRU
+    /* Adds the leaf to the list of leaves in memory, as the newest */
+    void Link(Leaf* l)
+    {
+        l->newer = 0;
+        l->older = newest;
+        if(newest) newest->newer = l; else oldest = l;
+        newest = l;
+      #ifdef LINE_COMPRESS
+        l->used = stamp;
+      #endif
+      #ifdef LINE_PAGING
+        PageFile.resident_leaves += 1;
+      #endif
+    }
+    void Unlink(Leaf* l)
+    {
+        if(l->newer) l->newer->older = l->older; else newest = l->older;
+        if(l->older) l->older->newer = l->newer; else oldest = l->newer;
+      #ifdef LINE_PAGING
+        PageFile.resident_leaves -= 1;
+        PageFile.resident_bytes  -= l->bytes;
+        l->bytes = 0;
+      #endif
+    }
+    /* Makes the leaf the most recently used one */
+    void Touch(Leaf* l)
+    {
+      #ifdef LINE_COMPRESS
+        l->used = stamp;
+      #endif
+        if(l == newest) return;
+      #ifdef LINE_PAGING
+        // The previous newest leaf is the one that was most likely
+        // edited, so now is a good time to see how big it has become.
+        Measure(newest);
+      #endif
+        Unlink(l);
+        Link(l);
+      #ifdef LINE_PAGING
+        Measure(l);
+      #endif
+    }
+  #endif
+  #ifdef LINETREE_LRU
+    /* Tries again to read the lines that could not be read back or
+     * unpacked. The leaf is not in the list of leaves in memory
+     * meanwhile, so the empty lines are never written over the page,
+     * nor packed over the block.
+     */
+    void Reread(Leaf* l)
+    {
+        unsigned long& unread_leaves = UnreadLeaves(l);
+        bool untouched = l->count == l->unread;
+        for(unsigned a=0; a<l->count && untouched; ++a)
+            untouched = l->lines[a].empty();
+        if(untouched)
+        {
+          #ifdef LINE_COMPRESS
+            if(l->packed)
+            {
+                if(!LinePack.Unpack(l->packed, l->lines, l->count)) return;
+                l->packed = 0;
+            }
+          #ifdef LINE_PAGING
+            else
+          #endif
+          #endif
+          #ifdef LINE_PAGING
+            if(!PageFile.Read(l->swap_pos, l->lines, l->count)) return;
+          #endif
+        }
+        else
+        {
+            // They have been edited since, so what was in the page
+            // or in the block can no longer be put back.
+            sprintf(StatusLine, "Lines that could not be read back were lost");
+          #ifdef LINE_COMPRESS
+            if(l->packed) { LinePack.Discard(l->packed); l->packed = 0; }
+          #endif
+        }
+        l->unread = 0;
+        unread_leaves -= 1;
+        Link(l);
+      #ifdef LINE_PAGING
+        Measure(l);
+        Trim();
+      #endif
+    }
+    /* The count of the leaves that could not be read back
+     * for the same reason as l
+     */
+    static unsigned long& UnreadLeaves(const Leaf* l)
+    {
+      #if defined(LINE_COMPRESS) && defined(LINE_PAGING)
+        return l->packed ? LinePack.unread_leaves : PageFile.unread_leaves;
+      #elif defined(LINE_COMPRESS)
+        (void)l;
+        return LinePack.unread_leaves;
+      #else
+        (void)l;
+        return PageFile.unread_leaves;
+      #endif
+    }
+  #endif
+  #ifdef LINE_PAGING
+    static void Measure(Leaf* l)
+    {
+        unsigned long bytes = sizeof(Leaf) + LeafCap * (unsigned long)sizeof(T);
+        for(unsigned a=0; a<l->count; ++a)
+            if(l->lines[a].capacity() > EditorLineInlineCells)
+                bytes += l->lines[a].capacity() * (unsigned long)sizeof(EditorCharType);
+        PageFile.resident_bytes += bytes - l->bytes;
+        l->bytes = bytes;
+    }
+    /* Writes the least recently used leaves into the swap file
+     * until the rest fit within the limit.
+     */
+    void Trim()
+    {
+        while(PageFile.resident_bytes > PageFile.limit
+           && PageFile.resident_leaves > MinResident)
+        {
+            Leaf* l = oldest;
+            if(!PageFile.Write(l->lines, l->count, l->swap_pos, l->swap_size))
+                break;
+            if(l == finger) finger = 0;
+            Unlink(l);
+            delete[] l->lines;
+            l->lines = 0;
+        }
+    }
+  #endif
+
+    /* The root was split. Grow the tree by one level. */
+    void GrowRoot(void* split, size_type split_size)
+    {
+        Node* n = NewNode();
+        n->count    = 2;
+        n->child[0] = root;  n->sizes[0] = total - split_size;
+        n->child[1] = split; n->sizes[1] = split_size;
+        n->cells[0] = SubtreeCells(root,  height);
+        n->cells[1] = SubtreeCells(split, height);
+        root = n;
+        ++height;
+    }
+
+    static void Release(T& line)
+    {
+        // Unlike clear(), this also releases the capacity of std::vector
+        T tmp;
+        tmp.swap(line);
+    }
+
+    /* Move k entries from src[srcpos..] into dst[dstpos..].
+     * Entries after dstpos in dst are shifted right to make room,
+     * and entries after the moved ones in src are shifted left.
+     */
+    void MoveLines(Leaf* dst, unsigned dstpos, Leaf* src, unsigned srcpos, unsigned k)
+    {
+        Load(dst);
+        Load(src);
+        unsigned long cells = 0;
+        {for(unsigned a=0; a<k; ++a)
+            cells += src->lines[srcpos+a].size();}
+        dst->cells += cells;
+        src->cells -= cells;
+        {for(unsigned a=dst->count; a-- > dstpos; )
+            dst->lines[a+k].swap(dst->lines[a]);}
+        {for(unsigned a=0; a<k; ++a)
+            dst->lines[dstpos+a].swap(src->lines[srcpos+a]);}
+        dst->count += k;
+        {for(unsigned a=srcpos+k; a<src->count; ++a)
+            src->lines[a-k].swap(src->lines[a]);}
+        src->count -= k;
+    }
+    static void MoveChildren(Node* dst, unsigned dstpos, Node* src, unsigned srcpos, unsigned k)
+    {
+        {for(unsigned a=dst->count; a-- > dstpos; )
+            { dst->sizes[a+k] = dst->sizes[a]; dst->cells[a+k] = dst->cells[a]; dst->child[a+k] = dst->child[a]; }}
+        {for(unsigned a=0; a<k; ++a)
+            { dst->sizes[dstpos+a] = src->sizes[srcpos+a]; dst->cells[dstpos+a] = src->cells[srcpos+a]; dst->child[dstpos+a] = src->child[srcpos+a]; }}
+        dst->count += k;
+        {for(unsigned a=srcpos+k; a<src->count; ++a)
+            { src->sizes[a-k] = src->sizes[a]; src->cells[a-k] = src->cells[a]; src->child[a-k] = src->child[a]; }}
+        src->count -= k;
+    }
+    void Move(void* dst, unsigned dstpos, void* src, unsigned srcpos, unsigned k, unsigned h)
+    {
+        if(h == 0) MoveLines((Leaf*)dst, dstpos, (Leaf*)src, srcpos, k);
+        else       MoveChildren((Node*)dst, dstpos, (Node*)src, srcpos, k);
+    }
+    static unsigned Count(void* p, unsigned h)
+    {
+        return h == 0 ? ((Leaf*)p)->count : ((Node*)p)->count;
+    }
+    static size_type SubtreeSize(void* p, unsigned h)
+    {
+        if(h == 0) return ((Leaf*)p)->count;
+        Node* n = (Node*)p;
+        size_type result = 0;
+        for(unsigned c=0; c<n->count; ++c) result += n->sizes[c];
+        return result;
+    }
+    static unsigned long SubtreeCells(const void* p, unsigned h)
+    {
+        if(h == 0) return ((const Leaf*)p)->cells;
+        const Node* n = (const Node*)p;
+        unsigned long result = 0;
+        for(unsigned c=0; c<n->count; ++c) result += n->cells[c];
+        return result;
+    }
+
+    /* Inserts the line at the given index within the subtree.
+     * If the subtree root had to be split, returns the new right-side
+     * sibling, and sets split_size to the number of lines within it.
+     */
+    void* InsertRec(void* p, unsigned h, size_type index, const T& line, size_type& split_size)
+    {
+        if(h == 0)
+        {
+            Leaf* l = (Leaf*)p;
+            Leaf* r = 0;
+            Load(l);
+            if(l->count == LeafCap)
+            {
+                r = NewLeaf();
+                MoveLines(r, 0, l, LeafCap/2, LeafCap - LeafCap/2);
+                if(index > l->count) { index -= l->count; l = r; }
+            }
+            {for(unsigned a=l->count; a-- > index; )
+                l->lines[a+1].swap(l->lines[a]);}
+            l->lines[index] = line;
+            ++l->count;
+            l->cells += line.size();
+            if(r) split_size = r->count;
+            return r;
+        }
+
+        Node* n = (Node*)p;
+        unsigned c = 0;
+        while(c+1 < n->count && index > n->sizes[c])
+            { index -= n->sizes[c]; ++c; }
+
+        size_type child_split_size = 0;
+        n->child[c] = Unshare(n->child[c], h-1);
+        void* newchild = InsertRec(n->child[c], h-1, index, line, child_split_size);
+        n->sizes[c] += 1;
+        n->cells[c] += line.size();
+        if(!newchild) return 0;
+
+        n->sizes[c] -= child_split_size;
+        n->cells[c] = SubtreeCells(n->child[c], h-1);
+        return InsertChild(n, h, c+1, newchild, child_split_size, split_size);
+    }
+    /* Adds the leaf after the last line */
+    void AppendLeaf(Leaf* l)
+    {
+        total += l->count;
+        if(!root) { root = l; height = 0; return; }
+        root = Unshare(root, height);
+        size_type split_size = l->count;
+        void* split = height == 0 ? (void*)l : AppendRec(root, height, l, split_size);
+        if(split) GrowRoot(split, split_size);
+    }
+    /* Adds the leaf as the last one within the subtree (h > 0).
+     * Returns like InsertRec().
+     */
+    void* AppendRec(void* p, unsigned h, Leaf* leaf, size_type& split_size)
+    {
+        Node* n = (Node*)p;
+        if(h == 1) return InsertChild(n, h, n->count, leaf, leaf->count, split_size);
+
+        unsigned c = n->count - 1;
+        size_type child_split_size = 0;
+        n->child[c] = Unshare(n->child[c], h-1);
+        void* newchild = AppendRec(n->child[c], h-1, leaf, child_split_size);
+        n->sizes[c] += leaf->count;
+        n->cells[c] += leaf->cells;
+        if(!newchild) return 0;
+
+        n->sizes[c] -= child_split_size;
+        n->cells[c] = SubtreeCells(n->child[c], h-1);
+        return InsertChild(n, h, c+1, newchild, child_split_size, split_size);
+    }
+    /* Moves the leaves of the subtree of other to the end of this tree,
+     * and deletes its nodes.
+     */
+    void SpliceRec(LineTreeType& other, void* p, unsigned h)
+    {
+        if(h > 0)
+        {
+            Node* n = (Node*)p;
+            for(unsigned c=0; c<n->count; ++c) SpliceRec(other, n->child[c], h-1);
+            delete n;
+            return;
+        }
+        Leaf* l = (Leaf*)p;
+      #ifdef LINETREE_LRU
+        // A leaf that could not be read back is in neither list
+        if(!l->unread)
+      #endif
+        {
+          #ifdef LINETREE_LRU
+            if(l->lines) { other.Unlink(l); Link(l); }
+          #endif
+          #ifdef LINE_PAGING
+            if(l->lines) Measure(l);
+          #endif
+        }
+        if(l->count) AppendLeaf(l);
+        else         DeleteLeaf(l);
+    }
+    /* Inserts a child at position c of n, which is at level h.
+     * Returns like InsertRec().
+     */
+    static void* InsertChild(Node* n, unsigned h, unsigned c, void* newchild, size_type newsize, size_type& split_size)
+    {
+        Node* r = 0;
+        if(n->count == NodeCap)
+        {
+            r = NewNode();
+            MoveChildren(r, 0, n, NodeCap/2, NodeCap - NodeCap/2);
+            if(c > n->count) { c -= n->count; n = r; }
+        }
+        {for(unsigned a=n->count; a-- > c; )
+            { n->sizes[a+1] = n->sizes[a]; n->cells[a+1] = n->cells[a]; n->child[a+1] = n->child[a]; }}
+        n->sizes[c] = newsize;
+        n->cells[c] = SubtreeCells(newchild, h-1);
+        n->child[c] = newchild;
+        ++n->count;
+        if(r) split_size = SubtreeSize(r, h);
+        return r;
+    }
+
+    /* Returns the length of the erased line */
+    unsigned long EraseRec(void* p, unsigned h, size_type index)
+    {
+        if(h == 0)
+        {
+            Leaf* l = (Leaf*)p;
+            Load(l);
+            unsigned long cells = l->lines[index].size();
+            Release(l->lines[index]);
+            {for(unsigned a=index+1; a<l->count; ++a)
+                l->lines[a-1].swap(l->lines[a]);}
+            --l->count;
+            l->cells -= cells;
+            return cells;
+        }
+        Node* n = (Node*)p;
+        unsigned c = 0;
+        while(index >= n->sizes[c])
+            { index -= n->sizes[c]; ++c; }
+        n->child[c] = Unshare(n->child[c], h-1);
+        unsigned long cells = EraseRec(n->child[c], h-1, index);
+        n->sizes[c] -= 1;
+        n->cells[c] -= cells;
+        Rebalance(n, h, c);
+        return cells;
+    }
+
+    /* After an erase, child c of n may have become less than half full.
+     * Either merge it with its neighbour, or even out the two.
+     */
+    void Rebalance(Node* n, unsigned h, unsigned c)
+    {
+        unsigned cap = (h-1 == 0) ? (unsigned)LeafCap : (unsigned)NodeCap;
+        if(n->count < 2 || Count(n->child[c], h-1) >= cap/2) return;
+
+        unsigned left = c > 0 ? c-1 : c, right = left+1;
+        void* lp = n->child[left]  = Unshare(n->child[left],  h-1);
+        void* rp = n->child[right] = Unshare(n->child[right], h-1);
+        unsigned lc = Count(lp, h-1), rc = Count(rp, h-1);
+        if(lc + rc <= cap)
+        {
+            // Merge right into left
+            Move(lp, lc, rp, 0, rc, h-1);
+            n->sizes[left] += n->sizes[right];
+            n->cells[left] += n->cells[right];
+            DeleteRec(rp, h-1);
+            {for(unsigned a=right+1; a<n->count; ++a)
+                { n->sizes[a-1] = n->sizes[a]; n->cells[a-1] = n->cells[a]; n->child[a-1] = n->child[a]; }}
+            --n->count;
+            return;
+        }
+        // Redistribute evenly
+        unsigned want = (lc + rc) / 2;
+        if(lc > want) Move(rp, 0, lp, want, lc-want, h-1);
+        else          Move(lp, lc, rp, 0, want-lc, h-1);
+        n->sizes[left]  = SubtreeSize(lp, h-1);
+        n->sizes[right] = SubtreeSize(rp, h-1);
+        n->cells[left]  = SubtreeCells(lp, h-1);
+        n->cells[right] = SubtreeCells(rp, h-1);
+    }
+
+    void DeleteRec(void* p, unsigned h)
+    {
+      #ifdef LINE_SNAPSHOTS
+        if(--Refs(p, h) > 0) return; // Still used by another tree
+      #endif
+        if(h == 0) { DeleteLeaf((Leaf*)p); return; }
+        Node* n = (Node*)p;
+        for(unsigned c=0; c<n->count; ++c) DeleteRec(n->child[c], h-1);
+        delete n;
+    }
+  #ifdef LINE_ARENA
+    static void ForgetRec(void* p, unsigned h)
+    {
+        if(h == 0)
+        {
+            Leaf* l = (Leaf*)p;
+          #ifdef LINETREE_ON_DEMAND
+            if(!l->lines) return;
+          #endif
+            for(unsigned a=0; a<l->count; ++a) l->lines[a].forget();
+            return;
+        }
+        Node* n = (Node*)p;
+        for(unsigned c=0; c<n->count; ++c) ForgetRec(n->child[c], h-1);
+    }
+  #endif
+  #ifdef LAZY_LOAD
+    void LoadRec(void* p, unsigned h)
+    {
+        if(h == 0) { Load((Leaf*)p); return; }
+        Node* n = (Node*)p;
+        for(unsigned c=0; c<n->count; ++c) LoadRec(n->child[c], h-1);
+    }
+    static bool LazyLeftRec(const void* p, unsigned h)
+    {
+        if(h == 0)
+        {
+            const Leaf* l = (const Leaf*)p;
+          #ifdef LINE_COMPRESS
+            if(l->packed) return false;
+          #endif
+          #ifdef LINE_PAGING
+            if(l->swap_size) return false;
+          #endif
+            return !l->lines;
+        }
+        const Node* n = (const Node*)p;
+        for(unsigned c=0; c<n->count; ++c)
+            if(LazyLeftRec(n->child[c], h-1)) return true;
+        return false;
+    }
+  #endif
+
+private:
+    void*     root;
+    unsigned  height; // 0 = root is a leaf
+    size_type total;
+
+    // The most recently accessed leaf, and the index of its first line
+    Leaf*     finger;
+    size_type finger_first;
+  #ifdef LINE_SNAPSHOTS
+    // The same for the const operator[], which may point to a shared leaf
+    Leaf*     rfinger;
+    size_type rfinger_first;
+  #endif
+
+  #ifdef LINETREE_LRU
+    // The leaves that are in memory, in the order of use
+    Leaf*     newest;
+    Leaf*     oldest;
+  #endif
+  #ifdef LINE_COMPRESS
+    // The time given to the last PackCold(), for marking the leaves used
+    unsigned long stamp;
+  #endif
+};
+
+#endif
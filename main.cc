@@ -4,12 +4,19 @@
 #include <string.h>
 #include <time.h>
 #include <ctype.h>
+#include <sys/stat.h>
 
 #include "langdefs.hh"
 #include "kbhit.hh"
 
 #include "vga.hh"
 #include "chartype.hh"
+#include "linetree.hh"
+#include "linescan.hh"
+#include "savefile.hh"
+#include "journal.hh"
+#include "tabcols.hh"
+#include "linediff.hh"
 #include "jsf.hh"
 
 #include "cpu.h"
@@ -29,7 +36,6 @@
 
 static const bool ENABLE_DRAG = false;
 
-static unsigned long chars_file  = 0;
 static unsigned long chars_typed = 0;
 
 static bool use9bit=false, dblw=false, dblh=false;
@@ -59,7 +65,44 @@ const char* fnpart(const char* fn)
 char StatusLine[256] = // WARNING: Not range-checked
 "Ad-hoc programming editor - (C) 2011-03-08 Joel Yliluoma";
 
-EditorLineVecType EditLines;
+#ifdef LINE_ARENA
+ArenaType LineArena; // Must be defined before anything that allocates from it
+#endif
+
+#ifdef ATTRIBUTE_CODES_IN_ANSI_ORDER
+ScreenCharType        StyleAttr[256];
+ScreenCharType        StyleAttr16[256];
+const ScreenCharType* StyleTable = StyleAttr;
+
+static void StyleTableInit() // Map every style N into VGA attribute N, until assigned
+{
+    for(unsigned id=0; id<256; ++id)
+        StyleAttr[id] = StyleAttr16[id] = (ScreenCharType)id << 8u;
+}
+#endif
+
+#ifdef LAZY_LOAD
+LazyFileType LazyFile;
+#endif
+#ifdef LINE_PAGING
+PageFileType PageFile(LINE_PAGING * 1024ul); // LINE_PAGING is the limit in kilobytes
+#endif
+
+#ifdef LINE_INTERNING
+InternTableType LineIntern;
+#endif
+#ifdef LINE_COMPRESS
+LinePackType LinePack(LINE_COMPRESS); // LINE_COMPRESS is the time in seconds
+#endif
+#ifdef EDIT_JOURNAL
+JournalType Journal;
+#endif
+
+LineTreeType EditLines;
+/* For reading lines without making a private copy of them
+ * if they are shared (LINE_INTERNING, LINE_SNAPSHOTS)
+ */
+static const LineTreeType& ReadLines = EditLines;
 
 struct Anchor
 {
@@ -83,6 +126,244 @@ unsigned char TabSize      =4;
 bool  UnsavedChanges  = false;
 char* CurrentFileName = nullptr;
 
+#ifdef KEEP_TABS
+TabColumnsType TabColumns(TabSize);
+#endif
+
+/* The screen column where cell x of line y begins */
+static unsigned CellColumn(size_t y, size_t x)
+{
+  #ifdef KEEP_TABS
+    if(y < EditLines.size()) return TabColumns.Column(y, ReadLines[y], x);
+  #else
+    y=y;
+  #endif
+    return x;
+}
+/* The cell of line y at screen column col, and the column where it begins */
+static unsigned ColumnCell(size_t y, size_t col, unsigned& begin)
+{
+  #ifdef KEEP_TABS
+    if(y < EditLines.size()) return TabColumns.Cell(y, ReadLines[y], col, begin);
+  #else
+    y=y;
+  #endif
+    return begin = col;
+}
+/* After the cursor was moved from line oldy to another line,
+ * puts it in the same screen column as it was
+ */
+static void KeepColumn(size_t oldy)
+{
+  #ifdef KEEP_TABS
+    unsigned begin;
+    Cur.x = ColumnCell(Cur.y, CellColumn(oldy, Cur.x), begin);
+  #else
+    oldy=oldy;
+  #endif
+}
+/* The tab size for converting the files that are loaded */
+static unsigned char LoadTabSize()
+{
+  #ifdef KEEP_TABS
+    return 0; // Keep the tabs as they are
+  #else
+    return TabSize;
+  #endif
+}
+/* Whether the character may be part of the indentation of a line */
+static inline bool IsIndentChar(unsigned char c)
+{
+  #ifdef KEEP_TABS
+    if(c == '\t') return true;
+  #endif
+    return c == ' ';
+}
+
+struct UndoEvent
+{
+    unsigned x, y;
+    unsigned n_delete;
+    EditorCharVecType insert_chars;
+};
+const unsigned   MaxUndo = 256;
+UndoEvent UndoQueue[MaxUndo];
+UndoEvent RedoQueue[MaxUndo];
+unsigned  UndoHead = 0, RedoHead = 0;
+unsigned  UndoTail = 0, RedoTail = 0;
+bool      UndoAppendOk = false;
+
+/* Follow mode (^KT): the lines that are appended to the file
+ * are added to the end of the buffer while waiting for input.
+ */
+static bool          Following  = false;
+static unsigned long FollowPos  = 0; // Where the line after the last LF that was added begins
+static unsigned long FollowPart = 0; // Bytes of that line in the buffer (a long line, in pieces)
+static unsigned long FollowTime = 0; // clock() when the file was last checked
+
+/* The size and the time of the file when it was loaded or saved,
+ * for noticing when something else changes it (see ReloadPoll()).
+ */
+static unsigned long FileStampSize = 0, FileStampTime = 0;
+static unsigned long ReloadTime    = 0; // clock() when the file was last checked
+
+static void FileStampTake()
+{
+    struct stat st;
+    if(CurrentFileName && stat(CurrentFileName, &st) == 0)
+        { FileStampSize = st.st_size; FileStampTime = st.st_mtime; }
+    else
+        FileStampSize = FileStampTime = 0;
+}
+
+/* After name has been saved, following it continues from the end of
+ * what was saved, if that was the buffer up to its empty last line.
+ * Otherwise the file no longer has the lines of the buffer; stop then.
+ */
+static void FollowSaved(const char* name, unsigned long bytes, bool resume)
+{
+    if(!Following || !CurrentFileName || strcmp(name, CurrentFileName)) return;
+    if(resume)
+        { FollowPos = bytes; FollowPart = 0; }
+    else
+    {
+        Following = false;
+        strcat(StatusLine, "; stopped following");
+    }
+}
+
+/* Tells in StatusLine why out could not be committed */
+static void SaveFailed(const char* what, const char* name, const SaveFileType& out)
+{
+    if(out.KeptFile())
+        sprintf(StatusLine, "Could not %s %s: %s; the text is in %s",
+            what, name, strerror(errno), out.KeptFile());
+    else
+        sprintf(StatusLine, "Could not %s %s: %s", what, name, strerror(errno));
+}
+
+#ifdef LINE_SNAPSHOTS
+/* With snapshots, saving happens in the background: InvokeSave() takes
+ * a snapshot of the buffer, and WaitInput() writes some more of it
+ * whenever there is nothing else to do. The buffer can be edited
+ * meanwhile; such edits mark it unsaved again.
+ */
+static LineTreeType SaveLines;    // The snapshot being saved
+static SaveFileType SaveFile;
+static size_t       SaveNext = 0; // The next line of SaveLines to write
+static bool         Saving   = false;
+#ifdef EDIT_JOURNAL
+static unsigned long SaveJournalMark = 0; // Journal.Mark() when the snapshot was taken
+#endif
+
+/* Writes up to nlines more lines of the snapshot,
+ * and finishes the saving once all of them have been written.
+ */
+static void SaveSome(size_t nlines)
+{
+    if(!Saving) return;
+    const LineTreeType& lines = SaveLines;
+    for(size_t n=0; n<nlines && SaveNext<lines.size(); ++n, ++SaveNext)
+        SaveFile.Put(lines[SaveNext]);
+    if(SaveNext < lines.size())
+    {
+        sprintf(StatusLine, "Saving %s... %lu%%", SaveFile.FileName(),
+            (unsigned long)(SaveNext * 100.0 / lines.size()));
+        return;
+    }
+    Saving = false;
+    if(SaveFile.Commit())
+    {
+        sprintf(StatusLine, "Saved %lu bytes to %s", SaveFile.bytes, SaveFile.FileName());
+        FileStampTake();
+        FollowSaved(SaveFile.FileName(), SaveFile.bytes, !SaveLines.size() || SaveLines[SaveLines.size()-1].empty());
+      #ifdef EDIT_JOURNAL
+        // Only the edits made during the saving remain unsaved
+        Journal.Rebase(SaveFile.FileName(), SaveJournalMark);
+      #endif
+    }
+    else
+    {
+        SaveFailed("save", SaveFile.FileName(), SaveFile);
+        UnsavedChanges = true;
+    }
+    SaveLines.clear();
+}
+/* Waits until the saving is complete */
+static void SaveFinish()
+{
+    SaveSome(~(size_t)0);
+}
+#endif
+
+static void DiscardBuffer() // Empty the buffer for loading another file
+{
+    Following = false;
+  #ifdef LINE_SNAPSHOTS
+    // The snapshot may refer to the lines that are being discarded
+    SaveFinish();
+  #endif
+  #ifdef EDIT_JOURNAL
+    // The edits are being discarded, too
+    Journal.Remove();
+  #endif
+  #ifdef KEEP_TABS
+    TabColumns.Clear();
+  #endif
+  #ifdef LINE_ARENA
+    // The lines and the undo history were all allocated from LineArena.
+    // Rather than freeing them one by one, forget them all,
+    // and give the whole arena back in one go.
+    EditLines.forget();
+    for(unsigned a=0; a<MaxUndo; ++a)
+    {
+        UndoQueue[a].insert_chars.forget();
+        RedoQueue[a].insert_chars.forget();
+    }
+    UndoHead=UndoTail=0;
+    RedoHead=RedoTail=0;
+    LineArena.ReleaseAll();
+  #else
+    EditLines.clear();
+  #endif
+  #ifdef LINE_INTERNING
+    // With LINE_ARENA, the lines that were forgotten still
+    // hold references to the shared lines
+    LineIntern.ReleaseAll();
+  #endif
+  #ifdef LAZY_LOAD
+    LazyFile.Close();
+  #endif
+}
+
+#ifdef LAZY_LOAD
+/* Index more of the file that is being loaded lazily,
+ * until there are at least nlines lines, or the file ends.
+ */
+static void LazyLoadUntil(size_t nlines)
+{
+    while(LazyFile.Indexing() && EditLines.size() < nlines)
+    {
+        unsigned long source, cells;
+        unsigned n = LazyFile.Scan(LineTreeType::LeafCap, source, cells);
+        EditLines.AppendLazy(source, n, cells);
+    }
+}
+static void LazyLoadFinish()
+{
+    LazyLoadUntil(~(size_t)0);
+}
+#endif
+
+/* Whether there is a line y. Indexes the file up to that line if needed. */
+static bool HaveLine(size_t y)
+{
+  #ifdef LAZY_LOAD
+    LazyLoadUntil(y+1);
+  #endif
+    return y < EditLines.size();
+}
+
 static void FileLoad(const char* fn)
 {
     fprintf(stderr, "Loading '%s'...\n", fn);
@@ -94,64 +375,49 @@ static void FileLoad(const char* fn)
     if(CurrentFileName) free(CurrentFileName);
     CurrentFileName = strdup(fn);
 
-    EditLines.clear();
+    DiscardBuffer();
 
-    int hadnl = 1;
-    EditorCharVecType editline;
-    int got_cr = 0;
+  #ifdef LAZY_LOAD
+    // Only index enough for the first screen. The rest of the file
+    // is indexed while waiting for input, and loaded when needed.
+    LazyFile.Open(fp, LoadTabSize());
+    Win = Cur = Anchor();
+    UnsavedChanges = false;
+    LazyLoadUntil(VidH);
+  #else
+    LineLoadType loader(LoadTabSize());
+  #ifdef __BORLANDC__
+    static unsigned char Buf[512];
+  #else
+    static unsigned char Buf[65536];
+  #endif
     for(;;)
     {
-        unsigned char Buf[512];
         size_t r = fread(Buf, 1, sizeof(Buf), fp);
         if(r == 0) break;
-        for(size_t a=0; a<r; ++a)
-        {
-            if(Buf[a] == '\r' && !got_cr) { got_cr = 1; continue; }
-            int maxrepeat = (got_cr && Buf[a] != '\n') ? 2 : 1;
-            for(int repeat=0; repeat<maxrepeat; ++repeat)
-            {
-                unsigned char c = Buf[a];
-                if(repeat == 0 && got_cr) c = '\n';
-
-                if(c == '\t')
-                {
-                    size_t nextstop = editline.size() + TabSize;
-                    nextstop -= nextstop % TabSize;
-                    editline.resize(nextstop, MakeUnknownColor(' '));
-                    /*while(editline.size() < nextstop)
-                        editline.push_back( MakeUnknownColor(' ') );*/
-                }
-                else
-                    editline.push_back( MakeUnknownColor(c) );
-
-                hadnl = 0;
-                if(c == '\n')
-                {
-                    EditLines.push_back(editline);
-                    editline.clear();
-                    hadnl = 1;
-                }
-            }
-            got_cr = Buf[a] == '\r';
-        }
-    }
-    if(hadnl)
-    {
-        EditLines.push_back(editline);
-        editline.clear();
+        loader.Feed(Buf, r, EditLines);
     }
+    loader.Finish(EditLines);
     fclose(fp);
     Win = Cur = Anchor();
     UnsavedChanges = false;
-
-    chars_file = 0;
-    for(size_t a=0; a<EditLines.size(); ++a)
-        chars_file += EditLines[a].size();
+  #endif
+    FileStampTake();
 }
 static void FileNew()
 {
     Win = Cur = Anchor();
     EditLines.clear();
+    Following = false;
+  #ifdef EDIT_JOURNAL
+    Journal.Remove();
+  #endif
+  #ifdef KEEP_TABS
+    TabColumns.Clear();
+  #endif
+  #ifdef LAZY_LOAD
+    LazyFile.Close();
+  #endif
     EditorCharVecType emptyline;
     emptyline.push_back(MakeUnknownColor('\n'));
     EditLines.push_back(emptyline);
@@ -160,7 +426,6 @@ static void FileNew()
 
     if(CurrentFileName) free(CurrentFileName);
     CurrentFileName = 0;
-    chars_file = 3; // Three newlines
 }
 struct ApplyEngine
 #if !(defined(__cplusplus) && __cplusplus >= 199700L)
@@ -172,10 +437,21 @@ struct ApplyEngine
     size_t x,y, begin_line;
     unsigned pending_recolor_distance, pending_recolor;
     EditorCharType pending_attr;
+    /* exact:    The state at begin_line was the right one (from a checkpoint).
+     * converge: Whether to stop where the state becomes the same as before.
+     * dirty_first..dirty_last: Lines that have been edited (or left
+     *           unhighlighted) since they were highlighted last time.
+     *           Empty when dirty_first > dirty_last.
+     */
+    bool exact, converge;
+    size_t dirty_first, dirty_last;
+    size_t begun; // The line that LineBegins() was last called for
     ApplyEngine()
-        { Reset(0); }
+        { Reset(0); exact = true; converge = false;
+          dirty_first = ~(size_t)0; dirty_last = 0; }
     void Reset(size_t line)
         { x=0; y=begin_line=line; finished=false; nlinestotal=nlines=0;
+          begun=~(size_t)0;
           pending_recolor=0;
           pending_attr   =0;
         }
@@ -184,13 +460,19 @@ struct ApplyEngine
 #endif
     int Get(void)
     {
-        if(y >= EditLines.size() || EditLines[y].empty())
+        if(y >= EditLines.size()
+      #if defined(LAZY_LOAD) || defined(LINE_COMPRESS)
+        // Do not load lines from the file (or unpack them) just to
+        // highlight them, unless they are going to be displayed anyway
+        || (x == 0 && !EditLines.loaded(y) && (y < Win.y || y >= Win.y + VidH))
+      #endif
+        || ReadLines[y].empty())
         {
             finished = true;
             FlushColor();
             return -1;
         }
-        int ret = ExtractCharCode(EditLines[y][x]);
+        int ret = ExtractCharCode(ReadLines[y][x]);
         if(ret == '\n')
         {
             if(kbhit()) { return -1; }
@@ -202,10 +484,70 @@ struct ApplyEngine
         }
         pending_recolor_distance += 1;
         ++x;
-        if(x == EditLines[y].size()) { x=0; ++y; }
+        if(x == ReadLines[y].size())
+        {
+            x=0; ++y;
+          #ifdef LINE_INTERNING
+            // The line before the one that was just finished
+            // is no longer going to be recolored (usually)
+            if(y >= 2) EditLines[y-2].intern();
+          #endif
+        }
         //fprintf(stdout, "Gets '%c'\n", ret);
         return ret;
     }
+    /* The state at the beginning of line y is the given checkpoint.
+     * Its number is kept in the color of the newline that ends the
+     * line before, which is never displayed. When the number there
+     * is the same as before, and none of the lines from here on
+     * have been edited since, the rest of the lines would not
+     * change either, so the highlighting is finished.
+     */
+#if !(defined(__cplusplus) && __cplusplus >= 199700L)
+    virtual cdecl
+#endif
+    int LineBegins(unsigned checkpoint, int settled)
+    {
+        // After an empty line, Get() may have returned -1 before
+        // getting its newline, and then Apply() calls this again
+        if(x != 0 || y == 0 || y > EditLines.size() || y == begun) return 1;
+        begun = y;
+        const EditorCharVecType& prev = ReadLines[y-1];
+        if(prev.empty() || ExtractCharCode(prev.back()) != '\n') return 1;
+        if(CheckpointAt(y) == checkpoint)
+        {
+            if(checkpoint && settled && converge && y > begin_line && y > dirty_last)
+            {
+                finished = true;
+                FlushColor();
+                return 0;
+            }
+        }
+        else
+            EditLines[y-1].back() = ::Recolor(prev.back(), (EditorCharType)checkpoint << 8);
+        return 1;
+    }
+    /* Returns the checkpoint at the beginning of line y, or 0 if there is none */
+    static unsigned CheckpointAt(size_t y)
+    {
+        if(y == 0 || y > EditLines.size()) return 0;
+      #if defined(LAZY_LOAD) || defined(LINE_COMPRESS)
+        if(!EditLines.loaded(y-1)) return 0;
+      #endif
+        const EditorCharVecType& prev = ReadLines[y-1];
+        if(prev.empty()) return 0;
+        EditorCharType nl = prev.back();
+        // Lines that have not been highlighted have MakeUnknownColor() there
+        if(ExtractCharCode(nl) != '\n' || ExtractColor(nl) == ExtractColor(MakeUnknownColor('\n')))
+            return 0;
+        return (unsigned)(ExtractColor(nl) >> 8);
+    }
+    /* This pass will not get any further than y */
+    void Abandon()
+    {
+        if(y < dirty_first) dirty_first = y;
+        if(y > dirty_last)  dirty_last  = y;
+    }
     /* attr     = Attribute to set
      * n        = Number of last characters to apply that attribute for
      * distance = Extra number of characters to count and skip
@@ -240,18 +582,32 @@ private:
         if(n > 0)
         {
             //fprintf(stdout, "Recolors %u as %02X\n", n, attr);
-            size_t px=x, py=y;
-            EditorCharVecType* line = &EditLines[py];
-            for(n += dist; n > 0; --n)
+            // The cells to recolor are the n cells that end dist cells
+            // before the current position. Usually they are all on the
+            // current line. If not, find where they begin from the offset index.
+            size_t px, py=y;
+            if(x >= n + dist)
+                px = x - dist - n;
+            else
             {
-                if(px == 0) { if(!py) break; line = &EditLines[--py]; px = line->size()-1; }
-                else --px;
-                if(dist > 0)
-                    --dist;
-                else
+                unsigned long end = EditLines.OffsetOf(y) + x;
+                end   = end > dist ? end - dist : 0;
+                n     = end > n ? n : (unsigned)end;
+                py    = EditLines.LineAt(end - n, px);
+            }
+            const EditorCharVecType* line = &ReadLines[py];
+            for(; n > 0; --n, ++px)
+            {
+                while(px >= line->size()) { px = 0; line = &ReadLines[++py]; }
+                // The newline holds the checkpoint (see LineBegins())
+                if(ExtractCharCode((*line)[px]) == '\n') continue;
+                // Only write the cells that change, so that lines
+                // that are shared (LINE_INTERNING) stay shared
+                EditorCharType w = ::Recolor((*line)[px], attr);
+                if(w != (*line)[px])
                 {
-                    EditorCharType& w = (*line)[px];
-                    w = ::Recolor(w, attr);
+                    EditLines[py][px] = w;
+                    line = &ReadLines[py];
                 }
             }
         }
@@ -359,7 +715,8 @@ void VisPutCursorAt(unsigned cx,unsigned cy)
 }
 void VisSetCursor()
 {
-    unsigned cx = Win.x > Cur.x ? 0 : Cur.x-Win.x;       if(cx >= VidW) cx = VidW-1;
+    unsigned col = CellColumn(Cur.y, Cur.x);
+    unsigned cx = Win.x > col ? 0 : col-Win.x;           if(cx >= VidW) cx = VidW-1;
     unsigned cy = Win.y > Cur.y ? 1 : Cur.y-Win.y; ++cy; if(cy >= VidH) cy = VidH-1;
     VisPutCursorAt(cx,cy);
 }
@@ -593,7 +950,16 @@ static void VisRenderTitleAndStatus()
 
     unsigned StatusWidth = VidW*columns;
 
-    static EditorCharVecType Hdr; Hdr.resize(FatMode ? StatusWidth*2 : StatusWidth);
+    // Not an EditorCharVecType, because this must outlive DiscardBuffer().
+    static ScreenCharType* Hdr = 0;
+    static unsigned HdrSize = 0;
+    unsigned HdrNeed = FatMode ? StatusWidth*2 : StatusWidth;
+    if(HdrSize < HdrNeed)
+    {
+        Hdr = (ScreenCharType*) realloc(Hdr, HdrNeed * sizeof(ScreenCharType));
+        memset(Hdr + HdrSize, 0, (HdrNeed - HdrSize) * sizeof(ScreenCharType));
+        HdrSize = HdrNeed;
+    }
     // We do the Mario update every frame, but this buffer is updated
     // less frequently, only ~18 times a second, because it's rather heavy.
     #ifdef __BORLANDC__
@@ -612,12 +978,12 @@ static void VisRenderTitleAndStatus()
         static char Part2[44]; sprintf(Part2, "Row %-5u/%u Col %u", // 4+11+1+11+5+11+nul
             (unsigned) (Cur.y+1),
             (unsigned) EditLines.size(), // (unsigned) EditLines.capacity(),
-            (unsigned) (Cur.x+1));
+            (unsigned) (CellColumn(Cur.y, Cur.x)+1));
 
         // RIGHT-side parts
         const char* Part3 = StatusGetClock();
-        static char Part4[26]; sprintf(Part4, "%lu/%lu C", chars_file, chars_typed); //11+1+11+2+nul
-        static const char Part5[] = "-11.4C"; // temperature degC degrees celsius
+        static char Part4[26]; sprintf(Part4, "%lu/%lu C", EditLines.cells(), chars_typed); //11+1+11+2+nul
+        static const char Part5[] = "-11.4\370C"; // temperature degC degrees celsius (\370 = CP437 degree sign)
 
         const char* Part6 = StatusGetCPUspeed();
 
@@ -743,21 +1109,30 @@ static void VisRender()
 
         unsigned ly = Win.y + y;
 
-        EditorCharVecType* line = &EmptyLine;
-        if(ly < EditLines.size()) line = &EditLines[ly];
+        const EditorCharVecType* line = &EmptyLine;
+        if(ly < EditLines.size()) line = &ReadLines[ly];
 
-        unsigned lw = line->size(), lx=0, x=Win.x, xl=x + VidW;
-        EditorCharType trail = MakeDefaultColor(' ');
-        for(unsigned l=0; l<lw; ++l)
+        // Begin from the cell that is at the left edge of the window
+        unsigned lw = line->size(), lx, x=Win.x, xl=x + VidW;
+        ScreenCharType trail = MakeDefaultColor(' ');
+        for(unsigned l=ColumnCell(ly, x, lx); l<lw; ++l)
         {
-            EditorCharType attr = (*line)[l];
+            ScreenCharType attr = ExpandEditorChar((*line)[l]);
             if(ExtractCharCode(attr) == '\n') break;
+          #ifdef KEEP_TABS
+            if(ExtractCharCode(attr) == '\t')
+            {
+                // Fill up to the next tab stop with spaces
+                lx += TabSize - 1 - lx % TabSize;
+                attr = (attr & ~ScreenCharType(0xFF)) | ' ';
+            }
+          #endif
             ++lx;
             if(lx > x)
             {
-                if( ((ly == BlockBegin.y && lx-1 >= BlockBegin.x)
+                if( ((ly == BlockBegin.y && l >= BlockBegin.x)
                   || ly > BlockBegin.y)
-                &&  ((ly == BlockEnd.y && lx-1 < BlockEnd.x)
+                &&  ((ly == BlockEnd.y && l < BlockEnd.x)
                   || ly < BlockEnd.y) )
                 {
                     attr = InvertColor(attr);
@@ -796,13 +1171,225 @@ ApplyEngine     SyntaxCheckingApplier;
 JSF::ApplyState SyntaxCheckingState;
 #endif
 
-/* TODO: In syntax checking: If the syntax checker ever reaches the current editing line,
- *                           make a save in the beginning of the line and use that for resuming
- *                           instead of backtracking to the context
+// How many lines to look back for a checkpoint for a quick fix of the screen
+#define SyntaxChecking_ContextOffset 50
+
+/* Begins highlighting from the checkpoint at the beginning of line y,
+ * or if there is none, from the closest one before it,
+ * looking back at most limit lines. Without one, begins from
+ * line y anyway, but then the result is not exact.
+ */
+static void SyntaxResume(size_t y, size_t limit)
+{
+    ApplyEngine& a = SyntaxCheckingApplier;
+    if(y >= EditLines.size()) y = EditLines.size() ? EditLines.size()-1 : 0;
+    size_t line = y;
+    a.exact = true;
+    for(;; --line)
+    {
+        if(line == 0)
+            { Syntax.ApplyInit(SyntaxCheckingState); break; }
+        if(Syntax.ApplyResume(SyntaxCheckingState, ApplyEngine::CheckpointAt(line)))
+            break;
+        if(y - line >= limit)
+            { line = y; a.exact = false; Syntax.ApplyInit(SyntaxCheckingState); break; }
+    }
+    a.Reset(line);
+    a.converge = a.exact;
+}
+/* Highlights from the top of the file */
+static void SyntaxRestart()
+{
+    ApplyEngine& a = SyntaxCheckingApplier;
+    Syntax.ApplyInit(SyntaxCheckingState);
+    a.Reset(0);
+    a.exact    = true;
+    a.converge = false;
+}
+/* Applies the highlighting until a key is pressed or it is finished */
+static void SyntaxApply()
+{
+    ApplyEngine& a = SyntaxCheckingApplier;
+  #if defined(__cplusplus) && __cplusplus >= 199700L
+    Syntax.Apply(SyntaxCheckingState);
+  #else
+    Syntax.Apply(SyntaxCheckingState, a);
+  #endif
+    if(!a.finished)
+        SyntaxCheckingNeeded = SyntaxChecking_Interrupted;
+    else if(!a.exact)
+        SyntaxCheckingNeeded = SyntaxChecking_DoingFull;
+    else if(a.begin_line > a.dirty_first)
+        SyntaxCheckingNeeded = SyntaxChecking_DidEdits;
+    else
+    {
+        SyntaxCheckingNeeded = SyntaxChecking_IsPerfect;
+        if(a.y > a.dirty_last || a.y+1 >= EditLines.size())
+            { a.dirty_first = ~(size_t)0; a.dirty_last = 0; }
+    }
+}
+/* Lines first..last were edited, and after first, lines were added
+ * (or removed, if negative).
  */
+static void SyntaxEdited(size_t first, size_t last, long added)
+{
+    ApplyEngine& a = SyntaxCheckingApplier;
+    // If the highlighting was already past the edit, it begins again.
+    // If not, it can just go on.
+    bool behind = SyntaxCheckingNeeded == SyntaxChecking_Interrupted && first <= a.y;
+    if(behind) a.Abandon();
+    if(a.dirty_first <= a.dirty_last && a.dirty_last > first)
+    {
+        long moved = (long)a.dirty_last + added;
+        a.dirty_last = moved < (long)first ? first : (size_t)moved;
+    }
+    if(first < a.dirty_first) a.dirty_first = first;
+    if(last  > a.dirty_last)  a.dirty_last  = last;
+    if(SyntaxCheckingNeeded == SyntaxChecking_IsPerfect || behind)
+        SyntaxCheckingNeeded = SyntaxChecking_DidEdits;
+}
 
-// How many lines to backtrack
-#define SyntaxChecking_ContextOffset 50
+/* ^KT: Begins following the file */
+static void FollowStart()
+{
+    if(!CurrentFileName) { sprintf(StatusLine, "No file to follow"); return; }
+    FILE* fp = fopen(CurrentFileName, "rb");
+    if(!fp)
+    {
+        sprintf(StatusLine, "Could not open %s: %s", CurrentFileName, strerror(errno));
+        return;
+    }
+  #ifdef LAZY_LOAD
+    // The new lines go after all of the lines in the file
+    LazyLoadFinish();
+  #endif
+    // FileLoad() left out whatever followed the last LF,
+    // so begin from there
+    fseek(fp, 0, SEEK_END);
+    unsigned long pos = ftell(fp);
+    for(bool found = false; pos > 0 && !found; )
+    {
+        unsigned char Buf[512];
+        size_t n = pos < sizeof(Buf) ? (size_t)pos : sizeof(Buf);
+        pos -= n;
+        fseek(fp, pos, SEEK_SET);
+        n = fread(Buf, 1, n, fp);
+        for(size_t a = n; a-- > 0; )
+            if(Buf[a] == '\n') { pos += a+1; found = true; break; }
+    }
+    fclose(fp);
+    FollowPos  = pos;
+    FollowPart = 0;
+    FollowTime = clock();
+    Following  = true;
+    sprintf(StatusLine, "Following %s", CurrentFileName);
+}
+/* Adds the lines that have been appended to the file being followed.
+ * Returns true if there were any.
+ */
+static bool FollowPoll()
+{
+    if(!Following) return false;
+  #ifdef LINE_SNAPSHOTS
+    // The file is being replaced; FollowPos is set once it has been
+    if(Saving) return false;
+  #endif
+    unsigned long now = clock();
+    if(now - FollowTime < CLOCKS_PER_SEC/4) return false;
+    FollowTime = now;
+
+    struct stat st;
+    if(stat(CurrentFileName, &st) != 0 || (unsigned long)st.st_size == FollowPos + FollowPart)
+        return false;
+    if((unsigned long)st.st_size < FollowPos + FollowPart)
+    {
+        // The file was truncated or replaced. Load it again,
+        // unless that would lose edits (like ReloadPoll()).
+        if(UnsavedChanges)
+        {
+            Following     = false;
+            FileStampSize = st.st_size;
+            FileStampTime = st.st_mtime;
+            sprintf(StatusLine, "%s was truncated; stopped following (^KA reloads it)", CurrentFileName);
+            return true;
+        }
+        char* name = strdup(CurrentFileName);
+        FileLoad(name);
+        free(name);
+        SyntaxCheckingNeeded = SyntaxChecking_DoingFull;
+        Syntax.ForgetCheckpoints();
+        UndoHead=UndoTail=0;
+        RedoHead=RedoTail=0;
+        FollowStart();
+        return true;
+    }
+    FILE* fp = fopen(CurrentFileName, "rb");
+    if(!fp) return false;
+  #ifdef __BORLANDC__
+    static unsigned char Buf[4096];
+  #else
+    static unsigned char Buf[65536];
+  #endif
+    size_t last = EditLines.size() ? EditLines.size()-1 : 0;
+    bool at_end = Cur.y >= last;
+    size_t was = 0;
+    LineLoadType loader(LoadTabSize());
+
+    // Read until the end of the file, unless a key is pressed or it
+    // takes too long; then the rest is read on the next call.
+    unsigned long fed = 0;  // Bytes added after FollowPos
+    unsigned long part = 0; // Of which after the last LF
+    bool behind = false;
+    for(;;)
+    {
+        fseek(fp, FollowPos + fed, SEEK_SET);
+        size_t r = fread(Buf, 1, sizeof(Buf), fp);
+        // Only add complete lines. The rest is added once its LF is there,
+        // unless it does not fit in Buf, in which case it is added in pieces.
+        size_t n = r;
+        while(n > 0 && Buf[n-1] != '\n') --n;
+        if(n == 0 && r == sizeof(Buf)) n = r;
+        if(n == 0) break;
+        if(fed == 0)
+        {
+            // The empty line at the end is where the new lines begin,
+            // and a partly added line is added again from its beginning
+            if(EditLines.size() && (FollowPart || EditLines[last].empty())) EditLines.erase(last);
+          #ifdef KEEP_TABS
+            TabColumns.Forget(last, ~(size_t)0);
+          #endif
+            was = EditLines.size();
+        }
+        loader.Feed(Buf, n, EditLines);
+        fed += n;
+        part = Buf[n-1] == '\n' ? 0 : part + n;
+        if(r < sizeof(Buf)) break;
+        // (Not in the middle of a line, which would be read again)
+        if(!part && (kbhit() || clock() - now > CLOCKS_PER_SEC/8)) { behind = true; break; }
+    }
+    fclose(fp);
+    if(fed == 0) return false;
+    loader.Finish(EditLines, part > 0);
+    FollowPos += fed - part;
+    FollowPart = part;
+    // If there is more, do not wait before reading it
+    if(behind) FollowTime = now - CLOCKS_PER_SEC/4;
+
+    if(at_end)
+    {
+        // Keep showing the end of the file
+        Cur.y = EditLines.size()-1;
+        Cur.x = 0;
+        if(Cur.y >= Win.y + VidH-1) Win.y = Cur.y - (VidH-1) + 1;
+        VisSetCursor();
+    }
+    // The highlighting continues from the checkpoint
+    // at the end of the old lines, rather than from the top
+    SyntaxEdited(last, EditLines.size()-1, (long)EditLines.size() - (long)was);
+    return true;
+}
+
+static bool ReloadPoll(); // After PerformEdit()
 
 static void WaitInput(bool may_redraw = true)
 {
@@ -822,8 +1409,9 @@ static void WaitInput(bool may_redraw = true)
     if(kbhit()) return;
 
     // Adjust window position horizontally making sure cursor is on screen
-    while(Cur.x < Win.x)         Win.x -= 8;
-    while(Cur.x >= Win.x + VidW) Win.x += 8;
+    {unsigned col = CellColumn(Cur.y, Cur.x);
+    while(col < Win.x)         Win.x -= 8;
+    while(col >= Win.x + VidW) Win.x += 8;}
 
     bool needs_redraw = false;
 
@@ -842,6 +1430,31 @@ static void WaitInput(bool may_redraw = true)
     {
         if(may_redraw)
         {
+            // Add the lines that were appended to the file being followed
+            if(FollowPoll()) needs_redraw = true;
+            // Reload the file if something else changed it
+            if(ReloadPoll()) needs_redraw = true;
+          #ifdef LAZY_LOAD
+            // Lines that were loaded from the file since last time
+            // have not been highlighted yet
+            static unsigned long reads_seen = 0;
+            if(LazyFile.num_reads != reads_seen)
+            {
+                reads_seen = LazyFile.num_reads;
+                if(SyntaxCheckingNeeded == SyntaxChecking_IsPerfect)
+                    SyntaxCheckingNeeded = SyntaxChecking_DoingFull;
+            }
+          #endif
+          #ifdef LINE_COMPRESS
+            // Neither have the lines that were unpacked
+            static unsigned long unpacks_seen = 0;
+            if(LinePack.num_unpacks != unpacks_seen)
+            {
+                unpacks_seen = LinePack.num_unpacks;
+                if(SyntaxCheckingNeeded == SyntaxChecking_IsPerfect)
+                    SyntaxCheckingNeeded = SyntaxChecking_DoingFull;
+            }
+          #endif
             if(SyntaxCheckingNeeded != SyntaxChecking_IsPerfect)
             {
                 bool horrible_sight =
@@ -856,31 +1469,25 @@ static void WaitInput(bool may_redraw = true)
                 if(SyntaxCheckingNeeded != SyntaxChecking_Interrupted
                 || horrible_sight)
                 {
-                    unsigned line = 0;
-
-                    if( horrible_sight)
-                        line = Win.y;
-                    else if(SyntaxCheckingNeeded != SyntaxChecking_DoingFull)
-                        line = Win.y>SyntaxChecking_ContextOffset ? Win.y-SyntaxChecking_ContextOffset : 0;
+                    bool full = SyntaxCheckingNeeded == SyntaxChecking_DoingFull;
+                    if(SyntaxCheckingNeeded == SyntaxChecking_Interrupted)
+                        SyntaxCheckingApplier.Abandon();
 
-                    Syntax.ApplyInit(SyntaxCheckingState);
-                    SyntaxCheckingApplier.Reset(line);
+                    if(horrible_sight)
+                    {
+                        SyntaxResume(Win.y, SyntaxChecking_ContextOffset);
+                        // That does not make the rest of the file right
+                        if(full) SyntaxCheckingApplier.exact = false;
+                    }
+                    else if(!full)
+                        // Resume from the first line that was edited
+                        SyntaxResume(SyntaxCheckingApplier.dirty_first, ~(size_t)0);
+                    else
+                        SyntaxRestart();
                 }
                 // Apply syntax coloring. Will continue applying colors until
                 // either a key is pressed, or the checking finishes.
-            #if defined(__cplusplus) && __cplusplus >= 199700L
-                Syntax.Apply(SyntaxCheckingState);
-            #else
-                Syntax.Apply(SyntaxCheckingState, SyntaxCheckingApplier);
-            #endif
-
-                // Update the need-syntax-checking state
-                SyntaxCheckingNeeded =
-                    !SyntaxCheckingApplier.finished
-                    ? SyntaxChecking_Interrupted
-                    : (SyntaxCheckingApplier.begin_line == 0)
-                        ? SyntaxChecking_IsPerfect
-                        : SyntaxChecking_DoingFull;
+                SyntaxApply();
 
                 // Something was changed, so refresh screen now
                 needs_redraw = true;
@@ -889,11 +1496,35 @@ static void WaitInput(bool may_redraw = true)
             if(needs_redraw)
                 { wx=Win.x; wy=Win.y; VisRender(); needs_redraw = false; }
         }
+      #ifdef LAZY_LOAD
+        // Index some more of the file that is being loaded
+        if(LazyFile.Indexing())
+            LazyLoadUntil(EditLines.size() + LineTreeType::LeafCap * 16);
+      #endif
+      #ifdef LINE_COMPRESS
+        // Compress a few of the lines that have not been used lately
+        EditLines.PackCold(time(0), 4);
+      #endif
+      #ifdef LINE_SNAPSHOTS
+        // Write some more of the file that is being saved
+        SaveSome(4096);
+      #endif
+      #ifdef EDIT_JOURNAL
+        // Write the edits made since the last time into the journal
+        Journal.Flush();
+      #endif
         VisRenderTitleAndStatus();
         VisSoftCursor(0);
 
-        if(SyntaxCheckingNeeded == SyntaxChecking_IsPerfect
-        || SyntaxCheckingNeeded != SyntaxChecking_DoingFull)
+        if((SyntaxCheckingNeeded == SyntaxChecking_IsPerfect
+         || SyntaxCheckingNeeded != SyntaxChecking_DoingFull)
+      #ifdef LAZY_LOAD
+        && !LazyFile.Indexing()
+      #endif
+      #ifdef LINE_SNAPSHOTS
+        && !Saving
+      #endif
+          )
         {
             if(SyntaxCheckingNeeded == SyntaxChecking_IsPerfect)
                 Cycles_Adjust(-1);
@@ -911,18 +1542,6 @@ static void WaitInput(bool may_redraw = true)
     }
 }
 
-struct UndoEvent
-{
-    unsigned x, y;
-    unsigned n_delete;
-    EditorCharVecType insert_chars;
-};
-const unsigned   MaxUndo = 256;
-UndoEvent UndoQueue[MaxUndo];
-UndoEvent RedoQueue[MaxUndo];
-unsigned  UndoHead = 0, RedoHead = 0;
-unsigned  UndoTail = 0, RedoTail = 0;
-bool      UndoAppendOk = false;
 static void AddUndo(const UndoEvent& event)
 {
     unsigned UndoBufSize = (UndoHead + MaxUndo - UndoTail) % MaxUndo;
@@ -990,13 +1609,16 @@ static void PerformEdit(
     if(eol_x > 0 && ExtractCharCode(EditLines[y].back()) == '\n') --eol_x;
     if(x > eol_x) x = eol_x;
 
+    size_t first_y = y, n_lines = EditLines.size();
+  #ifdef EDIT_JOURNAL
+    Journal.Add(x, y, n_delete, insert_chars);
+  #endif
+
     UndoEvent event;
     event.x = x;
     event.y = y;
     event.n_delete = 0;
 
-    chars_file += insert_chars.size();
-
     if(DoingUndo)
     {
         int s = sprintf(StatusLine,"Edit%u @%u,%u: Delete %u, insert '",
@@ -1016,7 +1638,7 @@ static void PerformEdit(
         unsigned n_lines_deleted = 0;
         // If the deletion spans across newlines, concatenate those lines first
         while(n_delete >= EditLines[y].size() - x
-           && y+1+n_lines_deleted < EditLines.size())
+           && HaveLine(y+1+n_lines_deleted))
         {
             ++n_lines_deleted;
             #define o()  if(c.y == y+n_lines_deleted) { c.y = y; c.x += EditLines[y].size(); }
@@ -1029,25 +1651,24 @@ static void PerformEdit(
         }
         if(n_lines_deleted > 0)
         {
+            EditLines.Changed(y);
             #define o() if(c.y > y) c.y -= n_lines_deleted
             AllCursors();
             #undef o
-            EditLines.erase(EditLines.begin()+y+1,
-                            EditLines.begin()+y+1+n_lines_deleted);
+            EditLines.erase(y+1, y+1+n_lines_deleted);
         }
         // Now the deletion can begin
         if(n_delete > EditLines[y].size()-x) n_delete = EditLines[y].size()-x;
 
-        chars_file += event.insert_chars.size();
         event.insert_chars.insert(
             event.insert_chars.end(),
             EditLines[y].begin() + x,
             EditLines[y].begin() + x + n_delete);
-        chars_file -= event.insert_chars.size();
 
         EditLines[y].erase(
             EditLines[y].begin() + x,
             EditLines[y].begin() + x + n_delete);
+        EditLines.Changed(y);
         #define o() if(c.y == y && c.x > x+n_delete) c.x -= n_delete; \
                else if(c.y == y && c.x > x) c.x = x
         AllCursors();
@@ -1067,18 +1688,16 @@ static void PerformEdit(
         if(insert_newline_count > 0)
         {
             EditorCharVecType nlvec(1, MakeUnknownColor('\n'));
-            EditorLineVecType new_lines( insert_newline_count, nlvec );
+            // Insert the new lines
+            EditLines.insert(y+1, insert_newline_count, nlvec);
             // Move the trailing part from current line to the beginning of last "new" line
-            new_lines.back().assign( EditLines[y].begin() + x, EditLines[y].end() );
+            EditLines[y+insert_newline_count].assign( EditLines[y].begin() + x, EditLines[y].end() );
             // Remove the trailing part from that line
             EditLines[y].erase(  EditLines[y].begin() + x, EditLines[y].end() );
             // But keep the newline character
             EditLines[y].push_back( nlvec[0] );
-            // Insert these new lines
-            EditLines.insert(
-                EditLines.begin()+y+1,
-                new_lines.begin(),
-                new_lines.end() );
+            EditLines.Changed(y);
+            EditLines.Changed(y+insert_newline_count);
             // Update cursors
             #define o() if(c.y == y && c.x >= x) { c.y += insert_newline_count; c.x -= x; } \
                    else if(c.y > y) { c.y += insert_newline_count; }
@@ -1105,6 +1724,7 @@ static void PerformEdit(
                     EditLines[y].begin() + x,
                     insert_chars.begin() + insert_beginpos,
                     insert_chars.begin() + p );
+                EditLines.Changed(y);
                 #define o() if(c.y == y && c.x >= x) c.x += n_inserted
                 AlmostAllCursors();
                 #undef o
@@ -1118,7 +1738,11 @@ static void PerformEdit(
             }
         }
     }
-    SyntaxCheckingNeeded = SyntaxChecking_DidEdits;
+  #ifdef KEEP_TABS
+    // If lines were added or removed, the lines after them have moved, too
+    TabColumns.Forget(first_y, EditLines.size() == n_lines ? y : ~(size_t)0);
+  #endif
+    SyntaxEdited(first_y, y, (long)EditLines.size() - (long)n_lines);
     switch(DoingUndo)
     {
         case DoingUndo_Not: // normal edit
@@ -1150,6 +1774,303 @@ static void PerformEdit(unsigned n_delete, unsigned n_insert1, unsigned char ch1
     PerformEdit(Cur.x, Cur.y, n_delete, txtbuf);
 }
 
+#ifdef EDIT_JOURNAL
+/* Continues the journal of the file that was just loaded, if it has one,
+ * by performing the edits in it. Otherwise begins a new journal.
+ */
+static void JournalRecover()
+{
+    if(!CurrentFileName) return;
+    if(!Journal.Resume(CurrentFileName))
+    {
+        if(!Journal.Active())
+            sprintf(StatusLine, "Not journaling %s: its journal file belongs to another file", CurrentFileName);
+        return;
+    }
+    unsigned long begin = clock(), n = 0;
+    unsigned x, y, n_delete, n_insert;
+    const unsigned char* insert;
+    EditorCharVecType txtbuf;
+    while(Journal.Next(x, y, n_delete, insert, n_insert))
+    {
+        // Skip anything that does not fit; it may be from a damaged journal
+        if(!HaveLine(y)) continue;
+        txtbuf.resize(n_insert);
+        for(unsigned a=0; a<n_insert; ++a) txtbuf[a] = MakeDefaultColor(insert[a]);
+        UndoAppendOk = false;
+        PerformEdit(x, y, n_delete, txtbuf);
+        ++n;
+    }
+    unsigned long ms = (clock() - begin) * 1000ul / CLOCKS_PER_SEC;
+    if(n)
+        sprintf(StatusLine, "Recovered %lu edits from %s in %lu ms", n, CurrentFileName, ms);
+}
+#endif
+
+/* Reloading the file when something else has changed it.
+ *
+ * The file is converted into lines the same way as when loading it,
+ * but only the hashes of the lines are kept. They are compared with
+ * the hashes of the lines in the buffer (see linediff.hh), and the file
+ * is then converted again, this time replacing each range of lines that
+ * differs (a hunk) with PerformEdit(). The lines that did not change
+ * keep their colors, the cursors and the block stay with the lines that
+ * they were on, and the reload can be undone a hunk at a time.
+ */
+static unsigned long LineHash(const EditorCharVecType& line)
+{
+    unsigned long h = 2166136261ul;
+    for(size_t a=0, n=line.size(); a<n; ++a)
+        h = (h ^ ExtractCharCode(line[a])) * 16777619ul;
+    return h;
+}
+/* Collects the hashes of the lines of the file */
+struct ReloadHashOut
+{
+    unsigned long* hashes;
+    size_t n, cap;
+    bool failed;
+
+    ReloadHashOut() : hashes(0), n(0), cap(0), failed(false) { }
+    ~ReloadHashOut() { free(hashes); }
+
+    void push_back(const EditorCharVecType& line)
+    {
+        if(n == cap)
+        {
+            size_t newcap = cap ? cap*2 : 1024;
+            unsigned long* h = (unsigned long*) realloc(hashes, newcap * sizeof(unsigned long));
+            if(!h) { failed = true; return; }
+            hashes = h;
+            cap    = newcap;
+        }
+        hashes[n++] = LineHash(line);
+    }
+};
+/* Replaces the hunks with the lines of the file */
+struct ReloadApplyOut
+{
+    const LineDiffType& diff;
+    size_t h;                // The next hunk
+    size_t line;             // Number of lines of the file converted so far
+    long   delta;            // Number of lines the hunks so far have added
+    EditorCharVecType chunk; // The lines of the file for hunk h
+    unsigned long removed, added;
+
+    ReloadApplyOut(const LineDiffType& d) : diff(d), h(0), line(0), delta(0), removed(0), added(0)
+    {
+        Settle();
+    }
+
+    void push_back(const EditorCharVecType& l)
+    {
+        if(h < diff.size() && line >= diff[h].b_begin)
+            chunk.insert(chunk.end(), l.begin(), l.end());
+        ++line;
+        Settle();
+    }
+    /* Replaces the hunks whose lines have all been converted.
+     * At the end of the file, all the rest.
+     */
+    void Settle(bool end = false)
+    {
+        while(h < diff.size() && (end || line >= diff[h].b_end))
+            Replace(diff[h++]);
+    }
+    void Replace(const LineDiffType::Hunk& k)
+    {
+        size_t y = k.a_begin + delta;
+        size_t n_old = k.a_end - k.a_begin, n_new = k.b_end - k.b_begin;
+        if(y >= EditLines.size()) { chunk.clear(); return; }
+        unsigned long n_delete = 0;
+        for(size_t a=0; a<n_old && y+a < EditLines.size(); ++a)
+            n_delete += ReadLines[y+a].size();
+
+        // The cursors within the hunk stay on the same line of it,
+        // as far as there are lines. The rest move with the lines.
+        Anchor cursors[NumCursors+1];
+        for(int cn=0; cn<NumCursors; ++cn) cursors[cn] = SavedCursors[cn];
+        cursors[NumCursors] = Win;
+        UndoAppendOk = false;
+        PerformEdit(0, y, n_delete, chunk);
+        for(int cn=0; cn<=NumCursors; ++cn)
+        {
+            Anchor& c = cursors[cn];
+            if(c.y >= y + n_old)
+                c.y = c.y + n_new - n_old;
+            else if(c.y >= y)
+            {
+                if(!n_new)                  { c.y = y; c.x = 0; }
+                else if(c.y - y >= n_new)   c.y = y + n_new-1;
+            }
+            if(cn < NumCursors) SavedCursors[cn] = c; else Win = c;
+        }
+        delta   += (long)n_new - (long)n_old;
+        removed += n_old;
+        added   += n_new;
+        chunk.clear();
+    }
+};
+/* Makes the buffer the same as the file again, replacing only the lines
+ * that differ. Returns false, with errno set, if the file could not be read.
+ */
+static bool FileReload(unsigned long& removed, unsigned long& added)
+{
+  #ifdef __BORLANDC__
+    static unsigned char Buf[512];
+  #else
+    static unsigned char Buf[65536];
+  #endif
+    FILE* fp = fopen(CurrentFileName, "rb");
+    if(!fp) return false;
+    FileStampTake();
+  #ifdef LINE_SNAPSHOTS
+    SaveFinish();
+  #endif
+
+    ReloadHashOut now, was;
+    {LineLoadType loader(LoadTabSize());
+    for(;;)
+    {
+        size_t r = fread(Buf, 1, sizeof(Buf), fp);
+        if(r == 0) break;
+        loader.Feed(Buf, r, now);
+    }
+    loader.Finish(now);}
+  #ifdef LAZY_LOAD
+    // The lines that have not been loaded yet would now be loaded
+    // from the changed file, so they cannot be compared
+    bool all_loaded = !LazyFile.Indexing();
+  #endif
+    for(size_t y=0; y<EditLines.size() && !was.failed; ++y)
+    {
+      #ifdef LAZY_LOAD
+        if(!EditLines.loaded(y)) { all_loaded = false; break; }
+      #endif
+        was.push_back(ReadLines[y]);
+    }
+    LineDiffType diff;
+    bool diffed = !now.failed && !was.failed
+      #ifdef LAZY_LOAD
+               && all_loaded
+      #endif
+               && diff.Compute(was.hashes, was.n, now.hashes, now.n);
+    if(!diffed)
+    {
+        // Load it all again, keeping the cursors on the same lines
+        fclose(fp);
+        Anchor cursors[NumCursors], win = Win;
+        removed = EditLines.size();
+        for(int cn=0; cn<NumCursors; ++cn) cursors[cn] = SavedCursors[cn];
+        char* name = strdup(CurrentFileName);
+        FileLoad(name);
+        free(name);
+      #ifdef LAZY_LOAD
+        LazyLoadFinish();
+      #endif
+        size_t last = EditLines.size() ? EditLines.size()-1 : 0;
+        for(int cn=0; cn<NumCursors; ++cn)
+        {
+            SavedCursors[cn] = cursors[cn];
+            if(SavedCursors[cn].y > last) SavedCursors[cn].y = last;
+        }
+        Win = win;
+        if(Win.y > last) Win.y = last;
+        SyntaxCheckingNeeded = SyntaxChecking_DoingFull;
+        Syntax.ForgetCheckpoints();
+        UndoHead=UndoTail=0;
+        RedoHead=RedoTail=0;
+        added   = EditLines.size();
+    }
+    else
+    {
+        rewind(fp);
+        ReloadApplyOut out(diff);
+        LineLoadType loader(LoadTabSize());
+        for(;;)
+        {
+            size_t r = fread(Buf, 1, sizeof(Buf), fp);
+            if(r == 0) break;
+            loader.Feed(Buf, r, out);
+        }
+        loader.Finish(out);
+        // If the file changed again meanwhile, the next check notices it
+        out.Settle(true);
+        fclose(fp);
+      #ifdef LAZY_LOAD
+        // All of the lines are loaded
+        LazyFile.Close();
+      #endif
+        removed = out.removed;
+        added   = out.added;
+    }
+  #ifdef EDIT_JOURNAL
+    // The buffer is now the file; the edits of the reload need no journal
+    Journal.Open(CurrentFileName);
+  #endif
+    UndoAppendOk   = false;
+    UnsavedChanges = false;
+    return true;
+}
+static int VerifyUnsavedExit(const char* action); // After InvokeReload()
+
+/* ^KA: Reloads the file */
+static void InvokeReload()
+{
+    if(!CurrentFileName) { sprintf(StatusLine, "No file to reload"); return; }
+    // Unless the lines can be diffed, the reload cannot be undone
+    if(UnsavedChanges && !VerifyUnsavedExit("RELOAD")) return;
+    unsigned long removed, added;
+    if(!FileReload(removed, added))
+    {
+        sprintf(StatusLine, "Could not reload %s: %s", CurrentFileName, strerror(errno));
+        return;
+    }
+    if(!removed && !added)
+        sprintf(StatusLine, "%s has not changed", CurrentFileName);
+    else
+        sprintf(StatusLine, "Reloaded %s: %lu lines removed, %lu added", CurrentFileName, removed, added);
+}
+/* Checks, now and then, whether something else has changed the file
+ * since it was loaded or saved. If so, reloads it, unless there are
+ * unsaved changes, in which case only tells about it (^KA reloads it).
+ * Returns true if something changed.
+ */
+static bool ReloadPoll()
+{
+    if(!CurrentFileName || Following) return false;
+  #ifdef LINE_SNAPSHOTS
+    if(Saving) return false;
+  #endif
+    unsigned long now = clock();
+    if(now - ReloadTime < CLOCKS_PER_SEC) return false;
+    ReloadTime = now;
+
+    struct stat st;
+    if(stat(CurrentFileName, &st) != 0
+    || ((unsigned long)st.st_size == FileStampSize && (unsigned long)st.st_mtime == FileStampTime))
+        return false;
+    if(UnsavedChanges)
+    {
+        // Only tell once
+        FileStampSize = st.st_size;
+        FileStampTime = st.st_mtime;
+      #ifdef LAZY_LOAD
+        // The lines that are still in the file are not the same anymore
+        if(LazyFile.Indexing() || EditLines.LazyLeft())
+        {
+            LazyFile.Invalidate();
+            sprintf(StatusLine, "%s was changed before all of it was loaded; it cannot be saved (^KA reloads it)", CurrentFileName);
+            return true;
+        }
+      #endif
+        sprintf(StatusLine, "%s was changed by something else; ^KA reloads it", CurrentFileName);
+        return true;
+    }
+    InvokeReload();
+    return true;
+}
+
 static void TryUndo()
 {
     unsigned UndoBufSize = (UndoHead + MaxUndo - UndoTail) % MaxUndo;
@@ -1216,7 +2137,6 @@ static void BlockIndent(int offset)
         if(BlockBegin.x >= outdent) BlockBegin.x -= outdent;
         if(BlockEnd.x   >= outdent) BlockEnd.x   -= outdent;
     }
-    SyntaxCheckingNeeded = SyntaxChecking_DidEdits;
 }
 
 static void GetBlock(EditorCharVecType& block)
@@ -1236,8 +2156,8 @@ static inline void FindPair()
 {
     int           PairDir  = 0;
     unsigned char PairChar = 0;
-    EditorCharType PairColor = ExtractColor(EditLines[Cur.y][Cur.x]);
-    switch(ExtractCharCode(EditLines[Cur.y][Cur.x]))
+    EditorCharType PairColor = ExtractColor(ReadLines[Cur.y][Cur.x]);
+    switch(ExtractCharCode(ReadLines[Cur.y][Cur.x]))
     {
         case '{': PairChar = '}'; PairDir = 1; break;
         case '[': PairChar = ']'; PairDir = 1; break;
@@ -1252,10 +2172,10 @@ static inline void FindPair()
     if(PairDir > 0)
         for(;;)
         {
-            if(++testx >= EditLines[testy].size())
+            if(++testx >= ReadLines[testy].size())
                 { testx=0; ++testy; if(testy >= EditLines.size()) return; }
-            if(ExtractColor(EditLines[testy][testx]) != PairColor) continue;
-            unsigned char c = ExtractCharCode(EditLines[testy][testx]);
+            if(ExtractColor(ReadLines[testy][testx]) != PairColor) continue;
+            unsigned char c = ExtractCharCode(ReadLines[testy][testx]);
             if(balance == 0 && c == PairChar) { Cur.x = testx; Cur.y = testy; return; }
             if(c == '{' || c == '[' || c == '(') ++balance;
             if(c == '}' || c == ']' || c == ')') --balance;
@@ -1264,11 +2184,11 @@ static inline void FindPair()
         for(;;)
         {
             if(testx == 0)
-                { if(testy == 0) return; testx = EditLines[--testy].size() - 1; }
+                { if(testy == 0) return; testx = ReadLines[--testy].size() - 1; }
             else
                 --testx;
-            if(ExtractColor(EditLines[testy][testx]) != PairColor) continue;
-            unsigned char c = ExtractCharCode(EditLines[testy][testx]);
+            if(ExtractColor(ReadLines[testy][testx]) != PairColor) continue;
+            unsigned char c = ExtractCharCode(ReadLines[testy][testx]);
             if(balance == 0 && c == PairChar) { Cur.x = testx; Cur.y = testy; return; }
             if(c == '{' || c == '[' || c == '(') ++balance;
             if(c == '}' || c == ']' || c == ')') --balance;
@@ -1456,6 +2376,10 @@ static int SelectFont()
 
 static int VerifyUnsavedExit(const char* action)
 {
+  #ifdef LINE_SNAPSHOTS
+    // If the saving fails, the changes are unsaved after all
+    SaveFinish();
+  #endif
     if(!UnsavedChanges) return 1;
     VisSoftCursor(-1);
     int s = sprintf(StatusLine, "FILE IS UNSAVED. PROCEED WITH %s? Y/N  ", action);
@@ -1566,29 +2490,91 @@ static void InvokeSave(int ask_name)
             if(name) free(name);
             return;
         }
-        if(CurrentFileName) free(CurrentFileName);
+        if(CurrentFileName)
+        {
+            // The file that was being followed is no longer the one edited
+            if(strcmp(name, CurrentFileName)) Following = false;
+            free(CurrentFileName);
+        }
         CurrentFileName = name;
     }
-    FILE* fp = fopen(CurrentFileName, "wb");
-    if(!fp)
+  #ifdef LAZY_LOAD
+    if(LazyFile.Stale())
     {
-        perror(CurrentFileName);
+        sprintf(StatusLine, "Could not save %s: some lines could not be loaded", CurrentFileName);
+        VisRenderTitleAndStatus();
+        return;
+    }
+    // The file that is written may be the one that the lines
+    // are being loaded from, so load all of them first
+    LazyLoadFinish();
+    EditLines.LoadAll();
+    LazyFile.Close();
+  #endif
+  #ifdef LINE_SNAPSHOTS
+    SaveFinish(); // One at a time
+    if(!SaveFile.Open(CurrentFileName))
+    {
+        sprintf(StatusLine, "Could not save %s: %s", CurrentFileName, strerror(errno));
+        VisRenderTitleAndStatus();
+        return;
+    }
+    EditLines.Snapshot(SaveLines);
+    SaveNext       = 0;
+    Saving         = true;
+  #ifdef EDIT_JOURNAL
+    SaveJournalMark = Journal.Mark();
+  #endif
+    UnsavedChanges = false;
+    SaveSome(0);
+    VisRenderTitleAndStatus();
+  #else
+  #ifdef EDIT_JOURNAL
+    unsigned long journal_mark = Journal.Mark();
+  #endif
+    SaveFileType out;
+    if(!out.Open(CurrentFileName))
+    {
+        sprintf(StatusLine, "Could not save %s: %s", CurrentFileName, strerror(errno));
+        VisRenderTitleAndStatus();
         return;
     }
     for(unsigned a=0; a<EditLines.size(); ++a)
+        out.Put(ReadLines[a]);
+  #ifdef LINE_PAGING
+    if(PageFile.unread_leaves)
     {
-        for(unsigned b=EditLines[a].size(), x=0; x<b; ++x)
-        {
-            char c = ExtractCharCode(EditLines[a][x]);
-            if(c == '\n') fputc('\r', fp);
-            fputc(c, fp);
-        }
+        // They would have been saved as empty lines
+        out.Abandon();
+        sprintf(StatusLine, "Could not save %s: some lines could not be read from the swap file", CurrentFileName);
+        VisRenderTitleAndStatus();
+        return;
     }
-    unsigned long size = ftell(fp);
-    fclose(fp);
-    sprintf(StatusLine, "Saved %lu bytes to %s", size, CurrentFileName);
+  #endif
+  #ifdef LINE_COMPRESS
+    if(LinePack.unread_leaves)
+    {
+        out.Abandon();
+        sprintf(StatusLine, "Could not save %s: some lines could not be unpacked", CurrentFileName);
+        VisRenderTitleAndStatus();
+        return;
+    }
+  #endif
+    if(!out.Commit())
+    {
+        SaveFailed("save", CurrentFileName, out);
+        VisRenderTitleAndStatus();
+        return;
+    }
+    sprintf(StatusLine, "Saved %lu bytes to %s", out.bytes, CurrentFileName);
+    FollowSaved(CurrentFileName, out.bytes, !EditLines.size() || EditLines[EditLines.size()-1].empty());
     VisRenderTitleAndStatus();
     UnsavedChanges = false;
+    FileStampTake();
+  #ifdef EDIT_JOURNAL
+    Journal.Rebase(CurrentFileName, journal_mark);
+  #endif
+  #endif
 }
 static inline void InvokeLoad()
 {
@@ -1604,13 +2590,189 @@ static inline void InvokeLoad()
         return;
     }
     FileLoad(name);
+  #ifdef EDIT_JOURNAL
+    JournalRecover();
+  #endif
     free(name);
 
     SyntaxCheckingNeeded = SyntaxChecking_DoingFull;
+    Syntax.ForgetCheckpoints();
     UndoHead=UndoTail=0;
     RedoHead=RedoTail=0;
     UndoAppendOk=false;
 }
+
+/* Inserts the lines from InsertFile() into the buffer, a chunk at a time */
+struct InsertFileOut
+{
+    unsigned x, y;            // Where the next chunk goes
+    unsigned long cells;      // Number of cells inserted so far
+    unsigned long merged;     // Of which in the current undo event
+    EditorCharVecType chunk;  // Lines that have not been inserted yet
+    unsigned newlines, tail;  // Newlines in the chunk, and cells after the last one
+
+  #ifdef __BORLANDC__
+    enum { ChunkCells = 4096 }; // Far below the 64 kB limit of one object
+  #else
+    enum { ChunkCells = 65536 };
+  #endif
+
+    InsertFileOut(unsigned x0, unsigned y0) : x(x0), y(y0), cells(0), merged(0), newlines(0), tail(0) { }
+
+    void push_back(const EditorCharVecType& line)
+    {
+        chunk.insert(chunk.end(), line.begin(), line.end());
+        if(!line.empty() && ExtractCharCode(line.back()) == '\n')
+            { ++newlines; tail = 0; }
+        else
+            tail += line.size();
+        if(chunk.size() >= ChunkCells) Flush();
+    }
+    void Flush()
+    {
+        if(chunk.empty()) return;
+        // The undo event counts its cells in an unsigned,
+        // which has only 16 bits in Borland C++
+        if(merged + chunk.size() > (unsigned)~0u) { UndoAppendOk = false; merged = 0; }
+        PerformEdit(x, y, 0u, chunk);
+        // The following chunks are joined into the same undo event
+        UndoAppendOk = true;
+        cells  += chunk.size();
+        merged += chunk.size();
+        if(newlines) { y += newlines; x = tail; }
+        else         x += tail;
+        chunk.clear();
+        newlines = tail = 0;
+    }
+};
+/* ^KR: Inserts a file at the cursor. The file is converted and inserted
+ * a chunk of lines at a time, so it is never all in memory in one piece.
+ * The insertion is one undo event, and becomes the block.
+ */
+static void InvokeInsertFile()
+{
+    char* name = nullptr;
+    int decision = PromptText("Insert what:", "", &name);
+    VisSetCursor();
+    VisRender();
+    if(!decision || !name || !*name)
+    {
+        if(name) free(name);
+        return;
+    }
+    FILE* fp = fopen(name, "rb");
+    if(!fp)
+    {
+        sprintf(StatusLine, "Could not open %s: %s", name, strerror(errno));
+        free(name);
+        return;
+    }
+    unsigned eol_x = EditLines[Cur.y].size();
+    if(eol_x > 0 && ExtractCharCode(EditLines[Cur.y].back()) == '\n') --eol_x;
+    if(Cur.x > eol_x) Cur.x = eol_x;
+    unsigned x = Cur.x, y = Cur.y;
+
+    InsertFileOut out(x, y);
+    LineLoadType loader(LoadTabSize());
+  #ifdef __BORLANDC__
+    static unsigned char Buf[512];
+  #else
+    static unsigned char Buf[65536];
+  #endif
+    UndoAppendOk = false;
+    for(;;)
+    {
+        size_t r = fread(Buf, 1, sizeof(Buf), fp);
+        if(r == 0) break;
+        loader.Feed(Buf, r, out);
+    }
+    loader.Finish(out, true);
+    out.Flush();
+    fclose(fp);
+
+    BlockBegin.x = x;     BlockBegin.y = y;
+    BlockEnd.x   = out.x; BlockEnd.y   = out.y;
+    sprintf(StatusLine, "Inserted %lu characters from %s", out.cells, name);
+    free(name);
+}
+/* ^KW: Writes the block into a file, straight from the lines */
+static void InvokeWriteBlock()
+{
+    if(BlockBegin.y > BlockEnd.y
+    || (BlockBegin.y == BlockEnd.y && BlockBegin.x >= BlockEnd.x))
+    {
+        sprintf(StatusLine, "No block");
+        return;
+    }
+    char* name = nullptr;
+    int decision = PromptText("Write block to:", "", &name);
+    VisSetCursor();
+    VisRender();
+    if(!decision || !name || !*name)
+    {
+        if(name) free(name);
+        return;
+    }
+  #ifdef LAZY_LOAD
+    if(LazyFile.Stale())
+    {
+        sprintf(StatusLine, "Could not write %s: some lines could not be loaded", name);
+        free(name);
+        return;
+    }
+    // The lines may still be loaded from the file that is written
+    if(CurrentFileName && !strcmp(name, CurrentFileName))
+    {
+        LazyLoadFinish();
+        EditLines.LoadAll();
+        LazyFile.Close();
+    }
+  #endif
+  #ifdef LINE_SNAPSHOTS
+    SaveFinish(); // One at a time
+  #endif
+    SaveFileType out;
+    if(!out.Open(name))
+    {
+        sprintf(StatusLine, "Could not write %s: %s", name, strerror(errno));
+        free(name);
+        return;
+    }
+    for(size_t y = BlockBegin.y; y <= BlockEnd.y && y < EditLines.size(); ++y)
+    {
+        const EditorCharVecType& line = ReadLines[y];
+        size_t x0 = 0, x1 = line.size();
+        if(y == BlockBegin.y && BlockBegin.x < x1) x0 = BlockBegin.x;
+        if(y == BlockEnd.y   && BlockEnd.x   < x1) x1 = BlockEnd.x;
+        if(x0 < x1) out.Put(line, x0, x1);
+    }
+  #ifdef LINE_PAGING
+    if(PageFile.unread_leaves)
+    {
+        out.Abandon();
+        sprintf(StatusLine, "Could not write %s: some lines could not be read from the swap file", name);
+        free(name);
+        return;
+    }
+  #endif
+  #ifdef LINE_COMPRESS
+    if(LinePack.unread_leaves)
+    {
+        out.Abandon();
+        sprintf(StatusLine, "Could not write %s: some lines could not be unpacked", name);
+        free(name);
+        return;
+    }
+  #endif
+    if(out.Commit())
+    {
+        sprintf(StatusLine, "Wrote %lu bytes to %s", out.bytes, name);
+        FollowSaved(name, out.bytes, false);
+    }
+    else
+        SaveFailed("write", name, out);
+    free(name);
+}
 static inline void LineAskGo() // Go to line
 {
     unsigned DimY = VidH-1;
@@ -1627,6 +2789,7 @@ static inline void LineAskGo() // Go to line
     Cur.x = 0;
     Cur.y = atoi(line) - 1;
     free(line);
+    HaveLine(Cur.y);
     //Win.y = (Cur.y > DimY/2) ? Cur.y - (DimY>>1) : 0;
     if(Win.y > Cur.y || Win.y+DimY-1 <= Cur.y)
     {
@@ -1640,6 +2803,150 @@ static inline void LineAskGo() // Go to line
     VisRenderTitleAndStatus();
     VisRender();
 }
+static inline void OffsetAskGo() // Go to character offset
+{
+    unsigned DimY = VidH-1;
+    char* line = nullptr;
+    char Buf[64] = "";
+    int decision = PromptText("Goto offset:", Buf, &line);
+    if(!decision || !line || !*line)
+    {
+        if(line) free(line);
+        return;
+    }
+    unsigned long offset = strtoul(line, nullptr, 0);
+    free(line);
+  #ifdef LAZY_LOAD
+    LazyLoadFinish();
+  #endif
+    if(EditLines.empty()) return;
+    size_t oldy = Cur.y, column;
+    Cur.y = EditLines.LineAt(offset, column);
+    Cur.x = column;
+    if(Win.y > Cur.y || Win.y+DimY-1 <= Cur.y)
+    {
+        Win.y = Cur.y > oldy
+            ? (Cur.y > (DimY/2)
+                ? Cur.y - (DimY/2)
+                : 0)
+            : Cur.y;
+    }
+    Win.x = 0;
+    VisRenderTitleAndStatus();
+    VisRender();
+}
+static void InvokeMemStats() // Display memory statistics; each press shows the next page
+{
+    static unsigned page = 0;
+    const unsigned NumPages = 7;
+    switch(page)
+    {
+        case 0: // How many lines did not fit in the inline buffer
+        {
+            unsigned long nlines = EditLines.size(), heap = 0;
+            for(size_t a=0; a<nlines; ++a)
+            {
+              #ifdef LINETREE_ON_DEMAND
+                if(!EditLines.resident(a)) continue;
+              #endif
+                if(ReadLines[a].capacity() > EditorLineInlineCells) ++heap;
+            }
+            unsigned long permille = nlines ? heap * 1000ul / nlines : 0;
+            sprintf(StatusLine, "Lines: %lu, on heap: %lu (%lu.%lu%%), inline capacity: %u cells",
+                nlines, heap, permille/10, permille%10, (unsigned)EditorLineInlineCells);
+            break;
+        }
+        case 1: // How well the line arena is doing
+        {
+          #ifdef LINE_ARENA
+            const ArenaType& a = LineArena;
+            // Fragmentation: how much of the memory in the chunks is on the free lists
+            unsigned long permille = a.chunk_bytes ? (a.free_bytes >> 10) * 1000ul / (a.chunk_bytes >> 10) : 0;
+            sprintf(StatusLine, "Arena: %lu chunks %luk, used %luk (asked %luk), free %luk (%lu.%lu%%), unused %luk, %lu large %luk",
+                a.num_chunks, a.chunk_bytes >> 10,
+                a.used_bytes >> 10, a.requested_bytes >> 10,
+                a.free_bytes >> 10, permille/10, permille%10,
+                a.UnusedBytes() >> 10,
+                a.num_large, a.large_bytes >> 10);
+          #else
+            sprintf(StatusLine, "Arena: not in use (build with -DLINE_ARENA)");
+          #endif
+            break;
+        }
+        case 2: // How big are the cells
+        {
+            unsigned styles = 0;
+          #ifdef ATTRIBUTE_CODES_IN_ANSI_ORDER
+            for(unsigned id=0; id<256; ++id)
+                if(StyleAttr[id] != (ScreenCharType)id << 8u) ++styles;
+          #endif
+            sprintf(StatusLine, "Cells: %u bytes in buffer, %u bytes on screen; %u styles in the style table",
+                (unsigned) sizeof(EditorCharType), (unsigned) sizeof(ScreenCharType), styles);
+            break;
+        }
+        case 3: // How much of the file has been looked at
+        {
+          #ifdef LAZY_LOAD
+            const LazyFileType& f = LazyFile;
+            sprintf(StatusLine, "Lazy load: indexed %luk of %luk, %lu lines loaded in %lu reads",
+                f.Indexed() >> 10, f.file_bytes >> 10, f.lines_read, f.num_reads);
+          #else
+            sprintf(StatusLine, "Lazy load: not in use (build with -DLAZY_LOAD)");
+          #endif
+            break;
+        }
+        case 4: // How well the paging is doing
+        {
+          #ifdef LINE_PAGING
+            const PageFileType& p = PageFile;
+            unsigned long lookups  = p.hits + p.misses;
+            unsigned long permille = lookups ? (unsigned long)(p.hits * 1000.0 / lookups) : 0;
+            sprintf(StatusLine, "Paging: %luk of %luk in %lu leaves, hits %lu misses %lu (%lu.%lu%% hit), %lu page-outs, swap %luk",
+                p.resident_bytes >> 10, p.limit >> 10, p.resident_leaves,
+                p.hits, p.misses, permille/10, permille%10,
+                p.page_outs, p.swap_bytes >> 10);
+          #else
+            sprintf(StatusLine, "Paging: not in use (build with -DLINE_PAGING=kilobytes)");
+          #endif
+            break;
+        }
+        case 5: // How many lines are shared
+        {
+          #ifdef LINE_INTERNING
+            const InternTableType& t = LineIntern;
+            // Dedup ratio: the size of the shared lines, compared to what they actually take
+            unsigned long cost     = t.payload_bytes + t.OverheadBytes();
+            unsigned long hundreds = cost ? (unsigned long)(t.shared_bytes * 100.0 / cost) : 0;
+            sprintf(StatusLine, "Interning: %lu lines share %lu payloads, %luk in %luk+%luk (%lu.%02lu:1), saved %ldk",
+                t.num_refs, t.num_payloads,
+                t.shared_bytes >> 10, t.payload_bytes >> 10, t.OverheadBytes() >> 10,
+                hundreds/100, hundreds%100,
+                ((long)t.shared_bytes - (long)cost) / 1024);
+          #else
+            sprintf(StatusLine, "Interning: not in use (build with -DLINE_INTERNING)");
+          #endif
+            break;
+        }
+        case 6: // How well the cold lines compress
+        {
+          #ifdef LINE_COMPRESS
+            const LinePackType& p = LinePack;
+            unsigned long hundreds = p.packed_bytes ? (unsigned long)(p.expanded_bytes * 100.0 / p.packed_bytes) : 0;
+            unsigned long avg_us   = p.num_unpacks ? (unsigned long)(p.unpack_ticks * 1e6 / p.TicksPerSecond() / p.num_unpacks) : 0;
+            unsigned long max_us   = (unsigned long)(p.unpack_max * 1e6 / p.TicksPerSecond());
+            sprintf(StatusLine, "Compress: %lu leaves %luk packed from %luk (%lu.%02lu:1), %lu packs %lu unpacks, avg %lu.%03lu ms max %lu.%03lu ms",
+                p.packed_leaves, p.packed_bytes >> 10, p.expanded_bytes >> 10,
+                hundreds/100, hundreds%100,
+                p.num_packs, p.num_unpacks,
+                avg_us/1000, avg_us%1000, max_us/1000, max_us%1000);
+          #else
+            sprintf(StatusLine, "Compress: not in use (build with -DLINE_COMPRESS=seconds)");
+          #endif
+            break;
+        }
+    }
+    page = (page + 1) % NumPages;
+}
 void ResizeAsk() // Ask for new screen dimensions
 {
     char* line = 0;
@@ -1661,8 +2968,8 @@ static inline void k_home(void)
 {
     unsigned indent = 0;
     while(indent < EditLines[Cur.y].size()
-       && ExtractCharCode(EditLines[Cur.y][indent]) == ' ') ++indent;
-    // indent = number of spaces in the beginning of the line
+       && IsIndentChar(ExtractCharCode(EditLines[Cur.y][indent]))) ++indent;
+    // indent = number of spaces (and tabs) in the beginning of the line
     Cur.x = (Cur.x == indent ? 0 : indent);
 }
 static void k_end(void)
@@ -1731,12 +3038,18 @@ int main(int argc, char**argv)
 
 #if defined(__BORLANDC__) || defined(__DJGPP__)
     InstallMario();
+#endif
+#ifdef ATTRIBUTE_CODES_IN_ANSI_ORDER
+    StyleTableInit();
 #endif
     Syntax.Parse("c.jsf");
     FileNew();
     if(argc == 2)
     {
         FileLoad(argv[1]);
+      #ifdef EDIT_JOURNAL
+        JournalRecover();
+      #endif
     }
 
     fprintf(stderr, "Beginning render\n");
@@ -1801,6 +3114,7 @@ int main(int argc, char**argv)
                 Cur.y += DimY;
                 if(Cur.y >= EditLines.size()) Cur.y = EditLines.size()-1;
                 Win.y = (Cur.y > offset) ? Cur.y-offset : 0;
+                KeepColumn(WasY);
                 /*if(Win.y + DimY > EditLines.size()
                 && EditLines.size() > DimY) Win.y = EditLines.size()-DimY;*/
                 if(ENABLE_DRAG && shift) dragalong = true;
@@ -1812,6 +3126,7 @@ int main(int argc, char**argv)
                 unsigned offset = Cur.y - Win.y;
                 if(Cur.y > DimY) Cur.y -= DimY; else Cur.y = 0;
                 Win.y = (Cur.y > offset) ? Cur.y-offset : 0;
+                KeepColumn(WasY);
                 if(ENABLE_DRAG && shift) dragalong = true;
                 break;
             }
@@ -1892,6 +3207,33 @@ int main(int argc, char**argv)
                         InvokeSave( 1 );
                         break;
                     }
+                    case 'r': case 'R': case CTRL('R'): // insert file
+                    {
+                        InvokeInsertFile();
+                        break;
+                    }
+                    case 'w': case 'W': case CTRL('W'): // write block into file
+                    {
+                        InvokeWriteBlock();
+                        break;
+                    }
+                    case 'a': case 'A': case CTRL('A'): // reload the file
+                    {
+                        InvokeReload();
+                        break;
+                    }
+                    case 't': case 'T': case CTRL('T'): // follow the file
+                    {
+                        if(Following)
+                        {
+                            Following = false;
+                            FileStampTake();
+                            sprintf(StatusLine, "Stopped following %s", CurrentFileName);
+                        }
+                        else
+                            FollowStart();
+                        break;
+                    }
                     case 'x': case 'X': case CTRL('X'): // save and exit
                     {
                         InvokeSave( 0 );
@@ -1928,11 +3270,21 @@ int main(int argc, char**argv)
                             charcode, charcode, charcode, charcode);
                         break;
                     }
+                    case 'i': case 'I': case CTRL('I'): // memory statistics
+                    {
+                        InvokeMemStats();
+                        break;
+                    }
                     case 'l': case 'L': case CTRL('L'): // ask line number and goto
                     {
                         LineAskGo();
                         break;
                     }
+                    case 'j': case 'J': case CTRL('J'): // ask character offset and goto
+                    {
+                        OffsetAskGo();
+                        break;
+                    }
                     case '\'': // Insert literal character
                     {
                         c = getch();
@@ -1967,11 +3319,13 @@ int main(int argc, char**argv)
                     case 'H': // up
                         if(Cur.y > 0) --Cur.y;
                         if(Cur.y < Win.y) Win.y = Cur.y;
+                        KeepColumn(WasY);
                         if(ENABLE_DRAG && shift) dragalong = true;
                         break;
                     case 'P': // down
                         if(Cur.y+1 < EditLines.size()) ++Cur.y;
                         if(Cur.y >= Win.y+DimY) Win.y = Cur.y - DimY+1;
+                        KeepColumn(WasY);
                         if(ENABLE_DRAG && shift) dragalong = true;
                         break;
                     case 0x47: // home
@@ -2028,16 +3382,21 @@ int main(int argc, char**argv)
                         break;
                     case 0x76: // ctrl-pgdn = goto end of file
                     ctrlpgdn:
+                      #ifdef LAZY_LOAD
+                        LazyLoadFinish();
+                      #endif
                         Cur.y = EditLines.size()-1;
                         Win.y = 0;
                         if(Cur.y >= Win.y+DimY) Win.y = Cur.y - DimY+1;
                         goto end;
                     case 0x77: // ctrl-home = goto beginning of window (vertically)
                         Cur.y = Win.y;
+                        KeepColumn(WasY);
                         if(ENABLE_DRAG && shift) dragalong = true;
                         break;
                     case 0x75: // ctrl-end = goto end of window (vertically)
                         Cur.y = Win.y + VidH-1;
+                        KeepColumn(WasY);
                         if(ENABLE_DRAG && shift) dragalong = true;
                         // Hide the status line
                         StatusLine[0] = '\0';
@@ -2123,6 +3482,10 @@ int main(int argc, char**argv)
                         C64palette = !C64palette;
                         DispUcase  = C64palette;
                         if(C64palette) use9bit = false;
+                      #ifdef ATTRIBUTE_CODES_IN_ANSI_ORDER
+                        // The C64 palette only has the 16 VGA colors
+                        StyleTable = C64palette ? StyleAttr16 : StyleAttr;
+                      #endif
                         goto newmode;
                     case 0x44: // F10
                         DispUcase = !DispUcase;
@@ -2180,7 +3543,7 @@ int main(int argc, char**argv)
                 goto delkey;
             case CTRL('I'):
             {
-                unsigned nspaces = TabSize - Cur.x % TabSize;
+                unsigned nspaces = TabSize - CellColumn(Cur.y, Cur.x) % TabSize;
                 PerformEdit(InsertMode?0u:nspaces, nspaces,' ');
                 break;
             }
@@ -2192,10 +3555,18 @@ int main(int argc, char**argv)
                 {
                     // Autoindent only in insert mode
                     while(nspaces < EditLines[Cur.y].size()
-                       && ExtractCharCode(EditLines[Cur.y][nspaces]) == ' ') ++nspaces;
+                       && IsIndentChar(ExtractCharCode(EditLines[Cur.y][nspaces]))) ++nspaces;
                     if(Cur.x < nspaces) nspaces = Cur.x;
                 }
+              #ifdef KEEP_TABS
+                // Copy the indentation as it is, tabs included
+                EditorCharVecType txtbuf(1, MakeDefaultColor('\n'));
+                for(unsigned a=0; a<nspaces; ++a)
+                    txtbuf.push_back( MakeDefaultColor(ExtractCharCode(EditLines[Cur.y][a])) );
+                PerformEdit(Cur.x, Cur.y, InsertMode?0u:1u, txtbuf);
+              #else
                 PerformEdit(InsertMode?0u:1u, 1,'\n', nspaces,' ');
+              #endif
                 //Win.x = 0;
                 WasAppend = true;
                 break;
@@ -2224,6 +3595,10 @@ int main(int argc, char**argv)
         }
     }
 exit:;
+  #ifdef EDIT_JOURNAL
+    // Whatever was not saved was meant to be discarded
+    Journal.Remove();
+  #endif
     Cur.x = 0; Cur.y = Win.y + VidH-2; InsertMode = true;
     if(FatMode || C64palette)
     {
@@ -184,7 +184,7 @@ static unsigned OverlayMarioByte(
 }
 
 void MarioTranslate(
-    const EditorCharType* model,
+    const ScreenCharType* model,
     unsigned short* target,
     unsigned width)
 {
@@ -214,7 +214,7 @@ void MarioTranslate(
 
     const unsigned base = FatMode ? 0x80 : 0xC0;
 
-    const EditorCharType chartable[6] =
+    const ScreenCharType chartable[6] =
         { MakeMarioColor(base + 0x0),
           MakeMarioColor(base + 0x3),
           MakeMarioColor(base + 0x4),
@@ -239,7 +239,7 @@ void MarioTranslate(
         int offset = basex - mariox;
 
         unsigned pos = basex >> 3;
-        EditorCharType word = model[pos];
+        ScreenCharType word = model[pos];
         unsigned char ch = ExtractCharCode(word);
 
         if(ch == 0xDC || (ch >= 0xB0 && ch <= 0xB2))
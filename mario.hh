@@ -1,6 +1,6 @@
 /* Ad-hoc programming editor for DOSBox -- (C) 2011-03-08 Joel Yliluoma */
 void MarioTranslate(
-    const EditorCharType* model,
+    const ScreenCharType* model,
     unsigned short*       target,
     unsigned width);
 
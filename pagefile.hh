@@ -0,0 +1,161 @@
+/* Ad-hoc programming editor for DOSBox -- (C) 2011-03-08 Joel Yliluoma */
+#ifndef bqtPageFileHH
+#define bqtPageFileHH
+
+/* A swap file for the leaves of the line tree (LineTreeType).
+ *
+ * When the lines in memory take more than the limit,
+ * the line tree writes the least recently used leaves here,
+ * and reads them back when they are accessed again.
+ * A page is one leaf: for each line, its length followed by its cells.
+ *
+ * A leaf remembers where its page is, and reuses the same place
+ * when it is written again, if it still fits. Otherwise it gets
+ * a new place at the end of the file. The file is discarded
+ * when the line tree is cleared.
+ *
+ * The swap file is created with tmpfile(), so it is placed
+ * wherever the C library puts temporary files (e.g. %TMPDIR%).
+ * Errors are reported in StatusLine. A leaf that could not be written
+ * stays in memory; one that could not be read back stays in the file.
+ *
+ * #include "chartype.hh" before this file (for EditorCharVecType).
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+/* The status line of the editor (defined in main.cc) */
+extern char StatusLine[256];
+
+class PageFileType
+{
+public:
+    typedef EditorCharVecType T;
+
+    unsigned long limit;           // Memory ceiling for the lines, in bytes
+
+    /* Statistics */
+    unsigned long resident_bytes;  // Memory used by the leaves that are in memory (approximately)
+    unsigned long resident_leaves; // Number of leaves in memory
+    unsigned long hits;            // Leaf accesses that found the lines in memory
+    unsigned long misses;          // Leaf accesses that had to read them from a file
+    unsigned long page_outs;       // Number of leaves written into the swap file
+    unsigned long swap_bytes;      // Size of the swap file
+    unsigned long unread_leaves;   // Leaves that could not be read back (yet)
+
+public:
+    PageFileType(unsigned long limit_bytes) : limit(limit_bytes), fp(0), failed(false)
+    {
+        resident_bytes = resident_leaves = 0;
+        hits = misses = page_outs = swap_bytes = 0;
+        unread_leaves = 0;
+    }
+    ~PageFileType()
+    {
+        Close();
+    }
+
+    /* Discards the swap file */
+    void Close()
+    {
+        if(fp) fclose(fp);
+        fp            = 0;
+        swap_bytes    = 0;
+        unread_leaves = 0;
+    }
+
+    /* Writes count lines into the swap file. The place to write them in
+     * is given by pos and size, which are updated if the lines did not fit.
+     * Returns false if the lines could not be written.
+     */
+    bool Write(const T* lines, unsigned count, unsigned long& pos, unsigned long& size)
+    {
+        if(!fp)
+        {
+            if(failed) return false;
+            fp = tmpfile();
+            if(!fp) { Report("create"); failed = true; return false; }
+        }
+        errno = 0;
+        unsigned long need = count * (unsigned long)sizeof(unsigned long);
+        {for(unsigned a=0; a<count; ++a)
+            need += lines[a].size() * (unsigned long)sizeof(EditorCharType);}
+        if(need > size)
+        {
+            pos         = swap_bytes;
+            size        = need;
+            swap_bytes += need;
+        }
+        if(fseek(fp, (long)pos, SEEK_SET) != 0) { Report("write"); return false; }
+        for(unsigned a=0; a<count; ++a)
+        {
+            const T& line = lines[a];
+            unsigned long len = line.size();
+            fwrite(&len, sizeof(len), 1, fp);
+            // Copy through a buffer, because the line is not
+            // necessarily contiguous (see gapbase.hh)
+            for(unsigned long p=0; p<len; )
+            {
+                unsigned n = 0;
+                while(n < BufCells && p < len) Buf[n++] = line[p++];
+                fwrite(Buf, sizeof(EditorCharType), n, fp);
+            }
+        }
+        // A full disk may only show when the buffer is flushed
+        if(fflush(fp) != 0 || ferror(fp)) { Report("write"); clearerr(fp); return false; }
+        page_outs += 1;
+        return true;
+    }
+
+    /* Reads count lines from the swap file into lines[0..count-1],
+     * which must be empty. Returns false if they could not be read,
+     * in which case the lines are left empty.
+     */
+    bool Read(unsigned long pos, T* lines, unsigned count)
+    {
+        errno = 0;
+        if(!fp || fseek(fp, (long)pos, SEEK_SET) != 0) { Report("read"); return false; }
+        for(unsigned a=0; a<count; ++a)
+        {
+            unsigned long len = 0;
+            if(fread(&len, sizeof(len), 1, fp) != 1) goto fail;
+            if(!len) continue;
+            lines[a].resize(len);
+            // A freshly resized line is contiguous
+            if(fread(&lines[a][0], sizeof(EditorCharType), len, fp) != len) goto fail;
+        }
+        return true;
+    fail:
+        Report("read");
+        clearerr(fp);
+        {for(unsigned a=0; a<count; ++a)
+            { T tmp; tmp.swap(lines[a]); }}
+        return false;
+    }
+
+private:
+    // Not copyable
+    PageFileType(const PageFileType&);
+    void operator=(const PageFileType&);
+
+    static void Report(const char* what)
+    {
+        sprintf(StatusLine, "Could not %s the swap file: %s", what,
+            errno ? strerror(errno) : "unexpected end of file");
+    }
+
+    enum { BufCells = 256 };
+
+    FILE*          fp;
+    bool           failed; // tmpfile() did not work; do not try again
+    EditorCharType Buf[BufCells];
+};
+
+#ifdef LINE_PAGING
+/* The swap file of the editor buffer (defined in main.cc) */
+extern PageFileType PageFile;
+#endif
+
+#endif
@@ -0,0 +1,276 @@
+/* Ad-hoc programming editor for DOSBox -- (C) 2011-03-08 Joel Yliluoma */
+#ifndef bqtSaveFileHH
+#define bqtSaveFileHH
+
+/* Saving the lines into a file.
+ *
+ * The character codes of the cells are collected into a large buffer,
+ * with a CR added before each LF, and the buffer is written in one go
+ * when it is full. The lines are written into a temporary file in the
+ * same directory (see TempName()), which replaces the file only once
+ * everything has been written successfully.
+ * If anything fails, the file is left untouched. The exception is a
+ * system that does not rename over an existing file, if the file has
+ * been removed and the renaming still fails: then the temporary file
+ * is kept (see KeptFile()).
+ * With UTF8_FILES, the characters are converted into UTF-8 on the way
+ * (see utf8conv.hh).
+ *
+ * #include "chartype.hh" before this file (for EditorCharVecType).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#if !defined(__BORLANDC__) && !defined(__DJGPP__)
+# include <sys/stat.h> // For keeping the permissions of the file
+#endif
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+#ifdef UTF8_FILES
+# include "utf8conv.hh"
+#endif
+
+class SaveFileType
+{
+public:
+    typedef EditorCharVecType T;
+
+    unsigned long bytes; // Number of bytes written so far
+
+public:
+    SaveFileType() : bytes(0), fp(0), name(0), temp(0), kept(0), buf(0), fill(0), error(0)
+  #ifdef UTF8_FILES
+        , raw(0)
+  #endif
+    {
+    }
+    ~SaveFileType()
+    {
+        Abandon();
+    }
+
+    /* Begins saving into the given file. Returns false, with errno set,
+     * if the temporary file could not be created.
+     */
+    bool Open(const char* filename)
+    {
+        Abandon();
+        size_t len = strlen(filename);
+        name = (char*) malloc(len + 1);
+        temp = (char*) malloc(len + 5);
+        buf  = (unsigned char*) malloc(BufSize);
+        if(!name || !temp || !buf) { Abandon(); errno = ENOMEM; return false; }
+      #ifdef UTF8_FILES
+        raw  = (unsigned char*) malloc(RawSize);
+        if(!raw) { Abandon(); errno = ENOMEM; return false; }
+        utf8.Reset();
+      #endif
+        strcpy(name, filename);
+        TempName(temp, filename);
+        fp = fopen(temp, "wb");
+        if(!fp) { int e = errno; Abandon(); errno = e; return false; }
+        bytes = 0;
+        fill  = 0;
+        error = 0;
+        return true;
+    }
+
+    /* Writes one line */
+    void Put(const T& line)
+    {
+        Put(line, 0, line.size());
+    }
+    /* Writes the cells begin..end-1 of the line */
+    void Put(const T& line, size_t begin, size_t end)
+    {
+        for(size_t p = begin, n = end; p < n; )
+        {
+          #ifdef UTF8_FILES
+            // The cells go into raw first, with the CRs. In UTF-8,
+            // each of them takes at most 3 bytes (or 2 with the CR).
+            size_t room = (BufSize - fill - 1) / 3;
+            if(room > RawSize / 2) room = RawSize / 2;
+          #else
+            // Leave room for the CRs: at most one per cell
+            size_t room = (BufSize - fill) / 2;
+          #endif
+            if(room == 0) { Flush(); continue; }
+            size_t k = n-p < room ? n-p : room;
+          #ifdef UTF8_FILES
+            fill += utf8.Encode(raw, Convert(raw, line, p, k), buf + fill);
+          #else
+            fill += Convert(buf + fill, line, p, k);
+          #endif
+            p += k;
+        }
+    }
+
+    /* Finishes the saving, and replaces the file with the temporary file.
+     * Returns false, with errno set, if something failed; the file
+     * is then left as it was, unless KeptFile() says otherwise.
+     * FileName() remains valid afterwards.
+     */
+    bool Commit()
+    {
+        if(!fp) { errno = EBADF; return false; }
+      #ifdef UTF8_FILES
+        if(fill == BufSize) Flush();
+        fill += utf8.Finish(buf + fill);
+      #endif
+        Flush();
+        if(fflush(fp) != 0 && !error) error = errno;
+        if(fclose(fp) != 0 && !error) error = errno;
+        fp = 0;
+        if(error) { int e = error; Drop(); errno = e; return false; }
+      #if !defined(__BORLANDC__) && !defined(__DJGPP__)
+        struct stat st;
+        if(stat(name, &st) == 0) chmod(temp, st.st_mode & 07777);
+      #endif
+        if(rename(temp, name) != 0)
+        {
+            // DOS (and Windows) do not rename over an existing file
+            int e = errno;
+            if(remove(name) != 0)
+                { Drop(); errno = e; return false; }
+            if(rename(temp, name) != 0)
+            {
+                // The file is gone; the temporary file is all there is
+                e = errno;
+                kept = temp; temp = 0;
+                Drop(); errno = e; return false;
+            }
+        }
+        free(temp); temp = 0;
+        Drop();
+        return true;
+    }
+
+    /* Stops saving, and removes the temporary file */
+    void Abandon()
+    {
+        Drop();
+        free(name);
+        free(kept);
+        name = 0;
+        kept = 0;
+    }
+
+    /* The file being saved */
+    const char* FileName() const { return name ? name : ""; }
+
+    /* If Commit() removed the file but could not replace it,
+     * the name of the temporary file that has the lines. Otherwise 0.
+     */
+    const char* KeptFile() const { return kept; }
+
+private:
+    // Not copyable
+    SaveFileType(const SaveFileType&);
+    void operator=(const SaveFileType&);
+
+  #ifdef __BORLANDC__
+    enum { BufSize = 8192 };
+  #else
+    enum { BufSize = 1u << 20 };
+  #endif
+  #ifdef UTF8_FILES
+    enum { RawSize = 4096 };
+  #endif
+
+    /* Makes the name of the temporary file for the given file, into
+     * temp (strlen(filename)+5 bytes). The extension is replaced with
+     * $ and the first and the last character of the original extension
+     * (foo.c -> foo.$c, foo.cpp -> foo.$cp, foo -> foo.$$$), so that
+     * the files that differ only by the extension do not share it.
+     */
+    static void TempName(char* temp, const char* filename)
+    {
+        strcpy(temp, filename);
+        char* ext = strrchr(temp, '.');
+        if(!ext || strpbrk(ext, "/\\:")) ext = temp + strlen(temp);
+        size_t elen = *ext ? strlen(ext+1) : 0;
+        char tail[5] = ".$$$";
+        if(elen >= 1) { tail[2] = ext[1]; tail[3] = elen >= 2 ? ext[elen] : '\0'; }
+        strcpy(ext, tail);
+        // Never the file itself
+        if(!strcmp(temp, filename))
+        {
+            char& last = temp[strlen(temp)-1];
+            last = last == '_' ? '~' : '_';
+        }
+    }
+
+    /* Closes and removes the temporary file, if there is one */
+    void Drop()
+    {
+        if(fp) fclose(fp);
+        if(temp) remove(temp);
+        free(temp);
+        free(buf);
+        fp   = 0;
+        temp = 0;
+        buf  = 0;
+      #ifdef UTF8_FILES
+        free(raw);
+        raw  = 0;
+      #endif
+    }
+    void Flush()
+    {
+        if(fill && !error && fwrite(buf, 1, fill, fp) != fill) error = errno ? errno : EACCES;
+        bytes += fill;
+        fill = 0;
+    }
+
+    /* Stores the characters of line[p..p+k-1] into out, with a CR
+     * before each LF. Returns the number of bytes stored.
+     */
+    static size_t Convert(unsigned char* out, const T& line, size_t p, size_t k)
+    {
+        size_t a = 0;
+      #ifndef GAP_BUFFER_LINES
+        // The cells are contiguous
+        const EditorCharType* cells = &line[p];
+      #ifdef __SSE2__
+        // Take the low bytes of the cells, 16 at a time
+        {const __m128i low = _mm_set1_epi16(0xFF);
+        for(; a+16 <= k; a += 16)
+        {
+            __m128i v0 = _mm_and_si128(_mm_loadu_si128((const __m128i*)(cells+a)),   low);
+            __m128i v1 = _mm_and_si128(_mm_loadu_si128((const __m128i*)(cells+a+8)), low);
+            _mm_storeu_si128((__m128i*)(out+a), _mm_packus_epi16(v0, v1));
+        }}
+      #endif
+        for(; a<k; ++a) out[a] = (unsigned char) ExtractCharCode(cells[a]);
+      #else
+        for(; a<k; ++a) out[a] = (unsigned char) ExtractCharCode(line[p+a]);
+      #endif
+        // Normally there is only one LF, at the end of the line
+        size_t n = k;
+        for(unsigned char* lf = out; (lf = (unsigned char*) memchr(lf, '\n', out+n-lf)) != 0; lf += 2)
+        {
+            memmove(lf+1, lf, out+n-lf);
+            *lf = '\r';
+            ++n;
+        }
+        return n;
+    }
+
+private:
+    FILE*          fp;
+    char*          name;   // The file being saved
+    char*          temp;   // The temporary file being written
+    char*          kept;   // The temporary file left behind by Commit()
+    unsigned char* buf;
+    size_t         fill;   // Number of bytes in buf
+    int            error;  // errno of the first write that failed, or 0
+  #ifdef UTF8_FILES
+    unsigned char* raw;    // The cells of a piece of a line, for utf8
+    Utf8EncodeType utf8;
+  #endif
+};
+
+#endif
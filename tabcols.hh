@@ -0,0 +1,172 @@
+/* Ad-hoc programming editor for DOSBox -- (C) 2011-03-08 Joel Yliluoma */
+#ifndef bqtTabColsHH
+#define bqtTabColsHH
+
+/* The screen columns of lines that contain tabs.
+ *
+ * When the tabs are kept in the lines as single cells, a cell
+ * no longer is at the screen column of the same number: each tab
+ * extends to the next tab stop. To find the column of a cell, or
+ * the cell at a column, without going through the line from its
+ * beginning every time, the positions of the tabs are recorded,
+ * along with the column where each of them ends. Between two tabs,
+ * the cells and the columns go one to one, so a binary search
+ * in the tabs gives the answer.
+ *
+ * The tabs are recorded for the lines that were asked about recently
+ * (a small table, indexed by the line number). The editor must
+ * call Forget() for the lines that it changes.
+ *
+ * #include "chartype.hh" before this file (for EditorCharVecType).
+ */
+
+#include <stdlib.h>
+
+class TabColumnsType
+{
+public:
+    typedef EditorCharVecType T;
+
+    /* Statistics */
+    unsigned long hits;   // Number of times the tabs of a line were already known
+    unsigned long misses; // Number of times the line had to be gone through
+
+public:
+    TabColumnsType(unsigned char tabsize) : tab(tabsize)
+    {
+        hits = misses = 0;
+        for(unsigned a=0; a<NumEntries; ++a)
+        {
+            entries[a].valid = false;
+            entries[a].y     = 0;
+            entries[a].tabs  = 0;
+            entries[a].cap   = 0;
+        }
+    }
+    ~TabColumnsType()
+    {
+        for(unsigned a=0; a<NumEntries; ++a) free(entries[a].tabs);
+    }
+
+    /* The screen column where cell x of line y begins.
+     * Beyond the end of the line, each cell is one column.
+     */
+    unsigned Column(size_t y, const T& line, unsigned x)
+    {
+        const Entry& e = Get(y, line);
+        unsigned k = TabsBefore(e, x);
+        if(!k) return x;
+        return e.tabs[k-1].end + (x - e.tabs[k-1].cell - 1);
+    }
+
+    /* The cell of line y that covers the screen column col,
+     * and the column where that cell begins (before col, if it is a tab).
+     */
+    unsigned Cell(size_t y, const T& line, unsigned col, unsigned& begin)
+    {
+        const Entry& e = Get(y, line);
+        // Find the number of tabs that end at or before the column
+        unsigned lo = 0, hi = e.ntabs;
+        while(lo < hi)
+        {
+            unsigned mid = (lo + hi) / 2;
+            if(e.tabs[mid].end <= col) lo = mid+1; else hi = mid;
+        }
+        unsigned cell = lo ? e.tabs[lo-1].cell+1 + (col - e.tabs[lo-1].end) : col;
+        begin = col;
+        if(lo < e.ntabs && cell >= e.tabs[lo].cell)
+        {
+            // The column is in the middle of the next tab
+            begin -= cell - e.tabs[lo].cell;
+            cell   = e.tabs[lo].cell;
+        }
+        return cell;
+    }
+
+    /* Lines first..last (inclusive) have changed */
+    void Forget(size_t first, size_t last)
+    {
+        for(unsigned a=0; a<NumEntries; ++a)
+            if(entries[a].y >= first && entries[a].y <= last)
+                entries[a].valid = false;
+    }
+    /* All lines have changed */
+    void Clear()
+    {
+        for(unsigned a=0; a<NumEntries; ++a) entries[a].valid = false;
+    }
+
+private:
+    // Not copyable
+    TabColumnsType(const TabColumnsType&);
+    void operator=(const TabColumnsType&);
+
+    enum { NumEntries = 128 };
+
+    struct Tab
+    {
+        unsigned cell; // Where the tab is in the line
+        unsigned end;  // The screen column after it
+    };
+    struct Entry
+    {
+        bool     valid;
+        size_t   y;
+        unsigned size;  // The length of the line, as a further check
+        unsigned ntabs, cap;
+        Tab*     tabs;
+    };
+
+    const Entry& Get(size_t y, const T& line)
+    {
+        Entry& e = entries[y % NumEntries];
+        if(e.valid && e.y == y && e.size == line.size()) { ++hits; return e; }
+        ++misses;
+        e.valid = true;
+        e.y     = y;
+        e.size  = line.size();
+        e.ntabs = 0;
+        unsigned col = 0;
+        for(unsigned a=0; a<e.size; ++a, ++col)
+        {
+            if(ExtractCharCode(line[a]) != '\t') continue;
+            col += tab - col % tab - 1;
+            if(e.ntabs == e.cap)
+            {
+                // If there is not enough memory, the rest of the tabs
+                // are taken to be one column wide
+                unsigned newcap = e.cap ? e.cap*2 : 8;
+                Tab* t = (Tab*) realloc(e.tabs, newcap * sizeof(Tab));
+                if(!t) break;
+                e.tabs = t;
+                e.cap  = newcap;
+            }
+            e.tabs[e.ntabs].cell = a;
+            e.tabs[e.ntabs].end  = col + 1;
+            ++e.ntabs;
+        }
+        return e;
+    }
+    /* The number of tabs before cell x */
+    static unsigned TabsBefore(const Entry& e, unsigned x)
+    {
+        unsigned lo = 0, hi = e.ntabs;
+        while(lo < hi)
+        {
+            unsigned mid = (lo + hi) / 2;
+            if(e.tabs[mid].cell < x) lo = mid+1; else hi = mid;
+        }
+        return lo;
+    }
+
+private:
+    unsigned char tab;
+    Entry         entries[NumEntries];
+};
+
+#ifdef KEEP_TABS
+/* The tab columns of the editor buffer (defined in main.cc) */
+extern TabColumnsType TabColumns;
+#endif
+
+#endif
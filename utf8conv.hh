@@ -0,0 +1,270 @@
+/* Ad-hoc programming editor for DOSBox -- (C) 2011-03-08 Joel Yliluoma */
+#ifndef bqtUtf8ConvHH
+#define bqtUtf8ConvHH
+
+/* Converting between UTF-8 files and the CP437 characters of the cells.
+ *
+ * The screen shows CP437, one byte per cell. With UTF8_FILES, the files
+ * are taken to be UTF-8: when loading, a UTF-8 sequence whose character
+ * is in CP437 becomes that byte, and when saving, the bytes 80..FF become
+ * UTF-8 sequences again. The bytes 00..7E are the same in both.
+ *
+ * What cannot be shown in CP437 (characters that are not in it, and bytes
+ * that are not valid UTF-8) is kept as it is, each byte as a pair of cells:
+ * an escape, 7F (shown as a "house"), followed by the byte itself.
+ * A 7F in the file becomes two 7Fs. Saving turns the pairs back into
+ * the bytes, so such parts of the file are saved exactly as they were.
+ * A lone 7F, or one followed by a byte below 80, is saved as 7F.
+ *
+ * Most of a source file is usually ASCII, which is copied as it is:
+ * FindNonAscii() finds where it ends, 16 bytes at a time with SSE2,
+ * or a machine word at a time without it.
+ */
+
+#include <string.h>
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+#ifdef LAZY_LOAD
+# error UTF8_FILES cannot be used with LAZY_LOAD
+#endif
+
+enum { Utf8Escape = 0x7F };
+
+/* The Unicode characters of the CP437 bytes 80..FF */
+static const unsigned short Cp437Unicode[128] = {
+    0x00C7,0x00FC,0x00E9,0x00E2,0x00E4,0x00E0,0x00E5,0x00E7,0x00EA,0x00EB,0x00E8,0x00EF,0x00EE,0x00EC,0x00C4,0x00C5,
+    0x00C9,0x00E6,0x00C6,0x00F4,0x00F6,0x00F2,0x00FB,0x00F9,0x00FF,0x00D6,0x00DC,0x00A2,0x00A3,0x00A5,0x20A7,0x0192,
+    0x00E1,0x00ED,0x00F3,0x00FA,0x00F1,0x00D1,0x00AA,0x00BA,0x00BF,0x2310,0x00AC,0x00BD,0x00BC,0x00A1,0x00AB,0x00BB,
+    0x2591,0x2592,0x2593,0x2502,0x2524,0x2561,0x2562,0x2556,0x2555,0x2563,0x2551,0x2557,0x255D,0x255C,0x255B,0x2510,
+    0x2514,0x2534,0x252C,0x251C,0x2500,0x253C,0x255E,0x255F,0x255A,0x2554,0x2569,0x2566,0x2560,0x2550,0x256C,0x2567,
+    0x2568,0x2564,0x2565,0x2559,0x2558,0x2552,0x2553,0x256B,0x256A,0x2518,0x250C,0x2588,0x2584,0x258C,0x2590,0x2580,
+    0x03B1,0x00DF,0x0393,0x03C0,0x03A3,0x03C3,0x00B5,0x03C4,0x03A6,0x0398,0x03A9,0x03B4,0x221E,0x03C6,0x03B5,0x2229,
+    0x2261,0x00B1,0x2265,0x2264,0x2320,0x2321,0x00F7,0x2248,0x00B0,0x2219,0x00B7,0x221A,0x207F,0x00B2,0x25A0,0x00A0};
+/* The same, sorted by the character, for Cp437FromUnicode() */
+static const unsigned short Cp437SortedUnicode[128] = {
+    0x00A0,0x00A1,0x00A2,0x00A3,0x00A5,0x00AA,0x00AB,0x00AC,0x00B0,0x00B1,0x00B2,0x00B5,0x00B7,0x00BA,0x00BB,0x00BC,
+    0x00BD,0x00BF,0x00C4,0x00C5,0x00C6,0x00C7,0x00C9,0x00D1,0x00D6,0x00DC,0x00DF,0x00E0,0x00E1,0x00E2,0x00E4,0x00E5,
+    0x00E6,0x00E7,0x00E8,0x00E9,0x00EA,0x00EB,0x00EC,0x00ED,0x00EE,0x00EF,0x00F1,0x00F2,0x00F3,0x00F4,0x00F6,0x00F7,
+    0x00F9,0x00FA,0x00FB,0x00FC,0x00FF,0x0192,0x0393,0x0398,0x03A3,0x03A6,0x03A9,0x03B1,0x03B4,0x03B5,0x03C0,0x03C3,
+    0x03C4,0x03C6,0x207F,0x20A7,0x2219,0x221A,0x221E,0x2229,0x2248,0x2261,0x2264,0x2265,0x2310,0x2320,0x2321,0x2500,
+    0x2502,0x250C,0x2510,0x2514,0x2518,0x251C,0x2524,0x252C,0x2534,0x253C,0x2550,0x2551,0x2552,0x2553,0x2554,0x2555,
+    0x2556,0x2557,0x2558,0x2559,0x255A,0x255B,0x255C,0x255D,0x255E,0x255F,0x2560,0x2561,0x2562,0x2563,0x2564,0x2565,
+    0x2566,0x2567,0x2568,0x2569,0x256A,0x256B,0x256C,0x2580,0x2584,0x2588,0x258C,0x2590,0x2591,0x2592,0x2593,0x25A0};
+static const unsigned char Cp437SortedByte[128] = {
+    0xFF,0xAD,0x9B,0x9C,0x9D,0xA6,0xAE,0xAA,0xF8,0xF1,0xFD,0xE6,0xFA,0xA7,0xAF,0xAC,
+    0xAB,0xA8,0x8E,0x8F,0x92,0x80,0x90,0xA5,0x99,0x9A,0xE1,0x85,0xA0,0x83,0x84,0x86,
+    0x91,0x87,0x8A,0x82,0x88,0x89,0x8D,0xA1,0x8C,0x8B,0xA4,0x95,0xA2,0x93,0x94,0xF6,
+    0x97,0xA3,0x96,0x81,0x98,0x9F,0xE2,0xE9,0xE4,0xE8,0xEA,0xE0,0xEB,0xEE,0xE3,0xE5,
+    0xE7,0xED,0xFC,0x9E,0xF9,0xFB,0xEC,0xEF,0xF7,0xF0,0xF3,0xF2,0xA9,0xF4,0xF5,0xC4,
+    0xB3,0xDA,0xBF,0xC0,0xD9,0xC3,0xB4,0xC2,0xC1,0xC5,0xCD,0xBA,0xD5,0xD6,0xC9,0xB8,
+    0xB7,0xBB,0xD4,0xD3,0xC8,0xBE,0xBD,0xBC,0xC6,0xC7,0xCC,0xB5,0xB6,0xB9,0xD1,0xD2,
+    0xCB,0xCF,0xD0,0xCA,0xD8,0xD7,0xCE,0xDF,0xDC,0xDB,0xDD,0xDE,0xB0,0xB1,0xB2,0xFE};
+
+/* The CP437 byte of the character, or 0 if it is not in CP437 (or is ASCII) */
+static unsigned char Cp437FromUnicode(unsigned long u)
+{
+    unsigned lo = 0, hi = 128;
+    while(lo < hi)
+    {
+        unsigned mid = (lo + hi) / 2;
+        if(Cp437SortedUnicode[mid] < u) lo = mid+1; else hi = mid;
+    }
+    return lo < 128 && Cp437SortedUnicode[lo] == u ? Cp437SortedByte[lo] : 0;
+}
+
+/* Returns the index of the first byte in p[0..n-1] that is 7F or above, or n if none */
+static size_t FindNonAscii(const unsigned char* p, size_t n)
+{
+    size_t a = 0;
+#ifdef __SSE2__
+    {const __m128i del = _mm_set1_epi8(0x7E);
+    for(; a+16 <= n; a += 16)
+    {
+        // 80..FF have the high bit set, and 7F is the only byte above 7E as signed
+        __m128i v = _mm_loadu_si128((const __m128i*)(p+a));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_or_si128(v, _mm_cmpgt_epi8(v, del)));
+        if(mask) return a + __builtin_ctz(mask);
+    }}
+#else
+    // A word at a time: adding 1 to a byte sets its high bit if it is 7F.
+    // A carry out of a byte of FF may flag the next byte too, but not
+    // without the byte of FF, so the bytes of a flagged word are checked one by one.
+    {const unsigned long ones = ~0ul / 255, high = ones << 7;
+    for(; a+sizeof(unsigned long) <= n; a += sizeof(unsigned long))
+    {
+        unsigned long w;
+        memcpy(&w, p+a, sizeof(w));
+        if((w | (w + ones)) & high) break;
+    }}
+#endif
+    for(; a<n; ++a)
+        if(p[a] >= Utf8Escape)
+            break;
+    return a;
+}
+
+/* Converts UTF-8 into CP437 and escapes. Decode() the file in pieces
+ * of any size, then call Finish(). After a newline (or any ASCII byte),
+ * the state is always the same as at the beginning of the file.
+ */
+class Utf8DecodeType
+{
+public:
+    Utf8DecodeType() : npend(0), need(0) { }
+
+    /* The number of bytes at the beginning of p[0..n-1] that Decode()
+     * would copy as they are.
+     */
+    size_t Plain(const unsigned char* p, size_t n) const
+    {
+        return npend ? 0 : FindNonAscii(p, n);
+    }
+
+    /* Converts in[0..n-1] into out, which must have room for 2*n+8 bytes.
+     * Returns the number of bytes stored. A sequence that is cut short
+     * at the end is completed by the next call.
+     */
+    size_t Decode(const unsigned char* in, size_t n, unsigned char* out)
+    {
+        unsigned char* o = out;
+        for(size_t a = 0; a < n; )
+        {
+            if(!npend)
+            {
+                size_t plain = FindNonAscii(in+a, n-a);
+                memcpy(o, in+a, plain);
+                o += plain;
+                a += plain;
+                if(a == n) break;
+            }
+            unsigned char b = in[a++];
+            if(npend)
+            {
+                if((b & 0xC0) == 0x80)
+                {
+                    pend[npend++] = b;
+                    if(npend == need) o = Complete(o);
+                    continue;
+                }
+                // The sequence was cut short
+                o = Escape(o);
+            }
+            if(b < Utf8Escape)
+                *o++ = b;
+            else if(b >= 0xC2 && b <= 0xF4)
+                { pend[0] = b; npend = 1; need = b < 0xE0 ? 2 : b < 0xF0 ? 3 : 4; }
+            else
+                { *o++ = Utf8Escape; *o++ = b; }
+        }
+        return o - out;
+    }
+    /* At the end of the file, a sequence that was cut short is kept
+     * as it was. out must have room for 8 bytes.
+     */
+    size_t Finish(unsigned char* out)
+    {
+        return Escape(out) - out;
+    }
+
+private:
+    // Not copyable
+    Utf8DecodeType(const Utf8DecodeType&);
+    void operator=(const Utf8DecodeType&);
+
+    unsigned char* Complete(unsigned char* o)
+    {
+        static const unsigned long least[5] = { 0, 0, 0x80, 0x800, 0x10000 };
+        unsigned long u = pend[0] & (0x7F >> need);
+        for(unsigned a=1; a<need; ++a) u = (u << 6) | (pend[a] & 0x3F);
+        unsigned char c = 0;
+        // Overlong forms, surrogates and values beyond Unicode are kept as they are
+        if(u >= least[need] && (u < 0xD800 || u > 0xDFFF) && u <= 0x10FFFF)
+            c = Cp437FromUnicode(u);
+        if(!c) return Escape(o);
+        *o++ = c;
+        npend = 0;
+        return o;
+    }
+    unsigned char* Escape(unsigned char* o)
+    {
+        for(unsigned a=0; a<npend; ++a) { *o++ = Utf8Escape; *o++ = pend[a]; }
+        npend = 0;
+        return o;
+    }
+
+private:
+    unsigned char pend[4]; // The sequence so far
+    unsigned      npend;   // Its length, or 0 if not in a sequence
+    unsigned      need;    // Its length when complete
+};
+
+/* Converts CP437 and escapes into UTF-8. Encode() the bytes in pieces
+ * of any size, then call Finish().
+ */
+class Utf8EncodeType
+{
+public:
+    Utf8EncodeType() : escape(false) { }
+
+    void Reset() { escape = false; }
+
+    /* Converts in[0..n-1] into out, which must have room for 3*n+1 bytes.
+     * Returns the number of bytes stored.
+     */
+    size_t Encode(const unsigned char* in, size_t n, unsigned char* out)
+    {
+        unsigned char* o = out;
+        for(size_t a = 0; a < n; )
+        {
+            if(!escape)
+            {
+                size_t plain = FindNonAscii(in+a, n-a);
+                memcpy(o, in+a, plain);
+                o += plain;
+                a += plain;
+                if(a == n) break;
+            }
+            unsigned char c = in[a++];
+            if(escape)
+            {
+                escape = false;
+                if(c >= 0x80)       { *o++ = c; continue; } // An escaped byte
+                *o++ = Utf8Escape;
+                if(c == Utf8Escape) continue;               // An escaped 7F
+            }
+            if(c == Utf8Escape)
+                escape = true;
+            else if(c < 0x80)
+                *o++ = c;
+            else
+            {
+                unsigned u = Cp437Unicode[c - 0x80];
+                if(u < 0x800)
+                    { *o++ = 0xC0 | (u >> 6); }
+                else
+                    { *o++ = 0xE0 | (u >> 12); *o++ = 0x80 | ((u >> 6) & 0x3F); }
+                *o++ = 0x80 | (u & 0x3F);
+            }
+        }
+        return o - out;
+    }
+    /* At the end, a lone escape is saved as 7F. out must have room for 1 byte. */
+    size_t Finish(unsigned char* out)
+    {
+        if(!escape) return 0;
+        escape = false;
+        *out = Utf8Escape;
+        return 1;
+    }
+
+private:
+    // Not copyable
+    Utf8EncodeType(const Utf8EncodeType&);
+    void operator=(const Utf8EncodeType&);
+
+    bool escape; // Whether the previous byte was an escape
+};
+
+#endif
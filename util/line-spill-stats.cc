@@ -0,0 +1,60 @@
+#include <cstdio>
+#include <vector>
+
+/* Utility that measures, over a corpus of source files, how many lines
+ * would spill to the heap for different values of LINE_INLINE_CELLS
+ * in my editor. Line lengths are counted in cells the same way as
+ * FileLoad() does: tabs are expanded, and the newline is a cell too.
+ *
+ * Usage: line-spill-stats file1 file2 ...
+ */
+
+static const unsigned TabSize = 4;
+
+int main(int argc, char** argv)
+{
+    static const unsigned capacities[] = { 8,16,24,32,40,48,64,80,96,128 };
+    const unsigned ncap = sizeof(capacities) / sizeof(*capacities);
+    std::vector<unsigned long> histogram; // Number of lines by length
+
+    for(int a=1; a<argc; ++a)
+    {
+        std::FILE* fp = std::fopen(argv[a], "rb");
+        if(!fp) { std::perror(argv[a]); continue; }
+        unsigned length = 0;
+        auto EndLine = [&](unsigned len)
+        {
+            if(len >= histogram.size()) histogram.resize(len+1);
+            ++histogram[len];
+            length = 0;
+        };
+        int c, got_cr = 0;
+        while((c = std::fgetc(fp)) != EOF)
+        {
+            if(c == '\r' && !got_cr) { got_cr = 1; continue; }
+            // A CR that is not followed by LF is treated as a newline
+            if(got_cr && c != '\n') EndLine(length+1);
+            got_cr = c == '\r';
+            if(c == '\t') { length += TabSize; length -= length % TabSize; continue; }
+            ++length;
+            if(c == '\n') EndLine(length);
+        }
+        EndLine(length);
+        std::fclose(fp);
+    }
+
+    unsigned long total = 0;
+    for(unsigned l=0; l<histogram.size(); ++l) total += histogram[l];
+    if(!total) return 0;
+    std::printf("%lu lines\n", total);
+    std::printf("%8s %10s %8s %14s\n", "inline", "on heap", "percent", "inline bytes");
+    for(unsigned n=0; n<ncap; ++n)
+    {
+        unsigned long spill = 0;
+        for(unsigned l=capacities[n]+1; l<histogram.size(); ++l) spill += histogram[l];
+        std::printf("%8u %10lu %7.2f%% %14lu\n",
+            capacities[n], spill, spill*100.0/total,
+            // Memory spent on the inline buffers, with 16-bit cells
+            total * capacities[n] * 2ul);
+    }
+}
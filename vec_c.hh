@@ -4,8 +4,10 @@
 
 /* Vector of unsigned char */
 
+#define TriviallyCopyable
 #define o(x) x(unsigned char,CharVecType)
 #include "vecbase.hh"
 #undef o
+#undef TriviallyCopyable
 
 #endif
@@ -7,9 +7,11 @@
 #include "vec_c.hh"
 
 #define UsePlacementNew
+#define TriviallyRelocatable
 #define o(x) x(CharVecType,CharPtrVecType)
 #include "vecbase.hh"
 #undef o
 #undef  UsePlacementNew
+#undef TriviallyRelocatable
 
 #endif
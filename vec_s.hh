@@ -4,8 +4,34 @@
 
 /* Vector of unsigned short */
 
+/* #define LINE_INLINE_CELLS to store that many cells
+ * within the vector object, avoiding a heap allocation
+ * for short lines (small-buffer optimization).
+ */
+#ifdef LINE_INLINE_CELLS
+# define VecInlineCapacity LINE_INLINE_CELLS
+#endif
+/* #define LINE_ARENA to allocate the lines from LineArena (arena.hh),
+ * so that the whole buffer can be released in one go.
+ */
+#ifdef LINE_ARENA
+# include "arena.hh"
+# define VecArena LineArena
+#endif
+/* #define LINE_INTERNING to let identical lines share their contents
+ * through LineIntern (intern.hh).
+ */
+#ifdef LINE_INTERNING
+# include "intern.hh"
+# define VecIntern LineIntern
+#endif
+#define TriviallyCopyable
 #define o(x) x(unsigned short,WordVecType)
 #include "vecbase.hh"
 #undef o
+#undef VecArena
+#undef VecIntern
+#undef TriviallyCopyable
+#undef VecInlineCapacity
 
 #endif
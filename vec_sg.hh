@@ -0,0 +1,19 @@
+/* Ad-hoc programming editor for DOSBox -- (C) 2011-03-08 Joel Yliluoma */
+#ifndef bqtWordGapVecHH
+#define bqtWordGapVecHH
+
+/* Gap buffer of unsigned short */
+
+/* #define LINE_ARENA to allocate the lines from LineArena (arena.hh),
+ * so that the whole buffer can be released in one go.
+ */
+#ifdef LINE_ARENA
+# include "arena.hh"
+# define VecArena LineArena
+#endif
+#define o(x) x(unsigned short,WordGapVecType)
+#include "gapbase.hh"
+#undef o
+#undef VecArena
+
+#endif
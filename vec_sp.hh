@@ -7,9 +7,14 @@
 #include "vec_s.hh"
 
 #define UsePlacementNew
+/* Lines that keep their cells within the object cannot be moved bitwise */
+#ifndef LINE_INLINE_CELLS
+# define TriviallyRelocatable
+#endif
 #define o(x) x(WordVecType,WordPtrVecType)
 #include "vecbase.hh"
 #undef o
 #undef UsePlacementNew
+#undef TriviallyRelocatable
 
 #endif
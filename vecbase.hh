@@ -5,9 +5,33 @@
  * #defines to add before #include:  T       = element type
  *                                   VecType = name of the vector class type to define
  *                                   UsePlacementNew = if #defined, call Construct() -- When T is another vector type.
+ *                                   VecInlineCapacity = if #defined, this many elements are stored
+ *                                                       within the vector object itself, and the heap
+ *                                                       is only used for longer vectors (small-buffer
+ *                                                       optimization). Only for plain-old-data types.
+ *                                                       Standard C++ compilers also use this class
+ *                                                       instead of std::vector when this is #defined.
+ *                                   TriviallyCopyable = if #defined, T can be copied, moved and destroyed
+ *                                                       as raw memory (memcpy/memmove, no destructor).
+ *                                   TriviallyRelocatable = if #defined, T can be moved to a new address
+ *                                                       as raw memory, as long as the original is then
+ *                                                       forgotten rather than destroyed. True for
+ *                                                       vectors that hold a pointer to their data.
+ *                                   VecArena = if #defined, the name of an ArenaType object (arena.hh)
+ *                                              to allocate the storage from, instead of malloc.
+ *                                              Standard C++ compilers also use this class
+ *                                              instead of std::vector when this is #defined.
+ *                                   VecIntern = if #defined, the name of an InternTableType object (intern.hh).
+ *                                               intern() makes the vector share its contents with
+ *                                               identical vectors. A shared vector makes a private
+ *                                               copy when it is about to be modified, including when
+ *                                               a non-const reference or iterator is taken.
+ *                                               Only for plain-old-data types.
+ *                                               Standard C++ compilers also use this class
+ *                                               instead of std::vector when this is #defined.
  */
 
-#if defined(__cplusplus) && __cplusplus >= 199711L
+#if defined(__cplusplus) && __cplusplus >= 199711L && !defined(VecInlineCapacity) && !defined(VecArena) && !defined(VecIntern)
 
 #include <vector>
 
@@ -22,6 +46,26 @@ o(q)
 # include <stdlib.h>
 # include <malloc.h>
 # include <stdio.h>
+# include <string.h>
+# if defined(__cplusplus) && __cplusplus >= 199711L
+#  include <new>
+#  include <utility>
+# endif
+#endif
+
+#if defined(VecInlineCapacity) && defined(UsePlacementNew)
+# error VecInlineCapacity requires a plain-old-data element type
+#endif
+#if defined(VecIntern) && defined(UsePlacementNew)
+# error VecIntern requires a plain-old-data element type
+#endif
+#ifdef VecIntern
+# define VecOwn() if(!cap && data) Unshare()
+#else
+# define VecOwn()
+#endif
+#if defined(TriviallyCopyable) || defined(TriviallyRelocatable)
+# define VecBitwiseMove
 #endif
 
 #define q(T,VecType) class VecType
@@ -53,60 +97,65 @@ public:
 #if !(defined(__cplusplus) && __cplusplus >= 199700L)
     // Construct() and Destruct() are needed only
     // because of lack of placement-new in pre-standard C++
-    void Construct() { data=0; len=0; cap=0; }
-    void Destruct()  { clear(); if(cap) deallocate(data,cap); }
+    void Construct() { SetEmpty(); }
+    void Destruct()  { clear(); if(cap) FreeData(); }
     void Construct(const VecType& b)
     {
-        data=0; len=b.len; cap=b.len;
-        if(len)
-        {
-            data = allocate(len);
-            if(!data) fprintf(stdout, "VecType: Failed to allocate %u bytes\n", (unsigned)len);
-            copy_construct(&data[0], &b.data[0],len);
-        }
+        SetEmpty();
+        CopyFrom(b);
     }
 #endif
-    o(q) () : data(0),len(0),cap(0) { }
-    ~o(q) () { clear(); if(cap) deallocate(data,cap); }
-    o(q) (size_type length) : data(0),len(0),cap(0)
+    o(q) () { SetEmpty(); }
+    ~o(q) () { clear(); if(cap) FreeData(); }
+    o(q) (size_type length)
     {
+        SetEmpty();
         resize(length);
     }
-    o(q) (size_type length, Ttype value) : data(0),len(0),cap(0)
+    o(q) (size_type length, Ttype value)
     {
+        SetEmpty();
         resize(length, value);
     }
-    o(q) (T const* first, T const* last) : data(0),len(0),cap(0)
+    o(q) (T const* first, T const* last)
     {
+        SetEmpty();
         assign(first, last);
     }
-    o(q) (const VecType& b) : data(0), len(b.len), cap(b.len)
+    o(q) (const VecType& b)
     {
-        if(len)
-        {
-            data = allocate(len);
-            if(!data) fprintf(stdout, "VecType: Failed to allocate %u bytes\n", (unsigned)len);
-            copy_construct(&data[0], &b.data[0], len);
-        }
+        SetEmpty();
+        CopyFrom(b);
     }
 #if defined(__cplusplus) && __cplusplus >= 201100L
-    o(q)(VecType&& b): data(b.data), len(b.len), cap(b.cap)
+    o(q)(VecType&& b)
     {
-        b.data = 0;
-        b.len  = 0;
-        b.cap  = 0;
+        SetEmpty();
+        swap(b);
     }
 #endif
     VecType& operator= (const VecType& b)
     {
         if(&b == this) return *this;
+      #ifdef VecIntern
+        if(b.shared())
+        {
+            clear();
+            data = b.data;
+            len  = b.len;
+            cap  = 0;
+            VecIntern.AddRef(data);
+            return *this;
+        }
+        VecOwn();
+      #endif
         if(len < b.len)
         {
             reserve(b.len);
             copy_assign(&data[0], &b.data[0], len);
             copy_construct(&data[len], &b.data[len], b.len-len);
         }
-        else if(len > b.len)
+        else // len >= b.len
         {
             destroy(&data[b.len], len-b.len);
             copy_assign(&data[0], &b.data[0], b.len);
@@ -126,10 +175,11 @@ public:
                 T const* last)
     {
         size_type newlen = (size_type) (last-first);
+        VecOwn();
         if(cap < newlen)
         {
             destroy(&data[0], len);
-            deallocate(data, cap);
+            FreeData();
             data = allocate(cap = newlen);
             if(!data) fprintf(stdout, "VecType: Failed to allocate %u bytes\n", (unsigned)newlen);
             copy_construct(&data[0], first, newlen);
@@ -153,10 +203,11 @@ public:
         clear();
         resize(newlen, value);
       #else
+        VecOwn();
         if(cap < newlen)
         {
             destroy(&data[0], len);
-            deallocate(data, cap);
+            FreeData();
             data = allocate(cap = newlen);
             if(!data) fprintf(stdout, "VecType: Failed to allocate %u bytes\n", (unsigned)newlen);
             construct(&data[0], newlen, value);
@@ -178,10 +229,10 @@ public:
     }
 
 public:
-    reference operator[] (size_type ind) { return data[ind]; }
+    reference operator[] (size_type ind) { VecOwn(); return data[ind]; }
     const_reference operator[] (size_type ind) const { return data[ind]; }
-    iterator begin() { return data; }
-    iterator end() { return data+len; }
+    iterator begin() { VecOwn(); return data; }
+    iterator end() { VecOwn(); return data+len; }
     reference front() { return *begin(); }
     reference back() { return (*this)[size()-1]; } //*rbegin(); }
     const_iterator begin() const { return data; }
@@ -200,6 +251,7 @@ public:
     void push_back(Ttype value)
     {
         //insert(end(), value);
+        VecOwn();
         if(len >= cap) reserve(cap ? cap*2 : default_size());
       #ifdef UsePlacementNew
         data[len++].Construct(value);
@@ -225,9 +277,14 @@ public:
             }
             else
             {
+              #ifdef VecBitwiseMove
+                relocate(&data[ins_pos+1], &data[ins_pos], len-ins_pos);
+                copy_construct(&data[ins_pos], &value, 1);
+              #else
                 move_construct(&data[len], &data[len-1], 1);
-                move_assign_backwards(&data[ins_pos+1], &data[ins_pos], len-ins_pos);
+                move_assign_backwards(&data[ins_pos+1], &data[ins_pos], len-ins_pos-1);
                 data[ins_pos] = value;
+              #endif
             }
             ++len;
             return data+ins_pos;
@@ -248,7 +305,7 @@ public:
         }
         T * newdata = allocate(newcap);
         if(!newdata) fprintf(stdout, "VecType: Failed to allocate %u bytes\n", (unsigned)newcap);
-        move_construct(&newdata[0], &data[0], ins_pos);
+        relocate(&newdata[0], &data[0], ins_pos);
       #if defined(__cplusplus) && __cplusplus >= 199700L
         new(&newdata[ins_pos]) T( value );
       #elif defined(UsePlacementNew)
@@ -256,9 +313,8 @@ public:
       #else
         newdata[ins_pos] = value;
       #endif
-        move_construct(&newdata[ins_pos+1], &data[ins_pos], len-ins_pos);
-        destroy(&data[0], len);
-        deallocate(data, cap);
+        relocate(&newdata[ins_pos+1], &data[ins_pos], len-ins_pos);
+        FreeData();
         ++len;
         data = newdata;
         cap  = newcap;
@@ -276,6 +332,14 @@ public:
         {
             if(ins_pos == len)
                 copy_construct(&data[ins_pos], first, count);
+          #ifdef VecBitwiseMove
+            else
+            {
+                // Shift the tail out of the way in one go, then fill the hole
+                relocate(&data[ins_pos+count], &data[ins_pos], len-ins_pos);
+                copy_construct(&data[ins_pos], first, count);
+            }
+          #else
             else
             {
                 /*******
@@ -394,6 +458,7 @@ public:
                   #endif
                 }
             }
+          #endif
             len += count;
             goto Done;
         }
@@ -408,14 +473,13 @@ public:
         }*/
         T * newdata = allocate(newcap);
         if(!newdata) fprintf(stdout, "VecType: Failed to allocate %u bytes\n", (unsigned)newcap);
-        move_construct(&newdata[0], &data[0], ins_pos);
+        relocate(&newdata[0], &data[0], ins_pos);
         copy_construct(&newdata[ins_pos], first, count);
-        move_construct(&newdata[ins_pos+count], &data[ins_pos], len-ins_pos);
+        relocate(&newdata[ins_pos+count], &data[ins_pos], len-ins_pos);
         #ifndef UsePlacementNew
         /*fprintf(stdout, "Became '%.*s'\n", (len+count)*sizeof(T), (const char*)newdata);*/
         #endif
-        destroy(&data[0], len);
-        deallocate(data, cap);
+        FreeData();
         len += count;
         data = newdata;
         cap  = newcap;
@@ -429,28 +493,39 @@ public:
     void erase(iterator pos)
     {
         size_type del_pos = pos - begin();
+      #ifdef VecBitwiseMove
+        destroy(&data[del_pos], 1);
+        relocate(&data[del_pos], &data[del_pos+1], len-del_pos-1);
+        --len;
+      #else
         move_assign(&data[del_pos], &data[del_pos+1], len-del_pos-1);
         destroy(&data[--len], 1);
+      #endif
     }
     void erase(iterator first, iterator last)
     {
         size_type del_pos = first - begin();
         size_type count   = last - first;
         if(!count) return;
+      #ifdef VecBitwiseMove
+        destroy(&data[del_pos], count);
+        relocate(&data[del_pos], &data[del_pos+count], len-del_pos-count);
+      #else
         move_assign(&data[del_pos], &data[del_pos+count], len-del_pos-count);
         destroy(&data[len-count], count);
+      #endif
         len -= count;
     }
 
     void reserve(size_type newcap)
     {
+        VecOwn();
         if(cap < newcap)
         {
             T * newdata = allocate(newcap);
             if(!newdata) fprintf(stdout, "VecType: Failed to allocate %u bytes\n", (unsigned)newcap);
-            move_construct(&newdata[0], &data[0], len);
-            destroy(&data[0], len);
-            deallocate(data, cap);
+            relocate(&newdata[0], &data[0], len);
+            FreeData();
             data = newdata;
             cap  = newcap;
         }
@@ -458,11 +533,13 @@ public:
 
     void pop_back()
     {
+        VecOwn();
         destroy(&data[--len], 1);
     }
 
     void resize(size_type newlen)
     {
+        VecOwn();
         if(newlen < len)
         {
             destroy(&data[newlen], len-newlen);
@@ -481,9 +558,8 @@ public:
             size_type newcap = newlen;
             T * newdata = allocate(newcap);
             if(!newdata) fprintf(stdout, "VecType: Failed to allocate %u bytes\n", (unsigned)newcap);
-            move_construct(&newdata[0], &data[0], len);
-            destroy(&data[0], len);
-            deallocate(data, cap);
+            relocate(&newdata[0], &data[0], len);
+            FreeData();
             construct(&newdata[len], newlen-len);
             data = newdata;
             len  = newlen;
@@ -493,6 +569,7 @@ public:
 
     void resize(size_type newlen, Ttype value)
     {
+        VecOwn();
         if(newlen < len)
         {
             destroy(&data[newlen], len-newlen);
@@ -511,9 +588,8 @@ public:
             size_type newcap = newlen;
             T * newdata = allocate(newcap);
             if(!newdata) fprintf(stdout, "VecType: Failed to allocate %u bytes\n", (unsigned)newcap);
-            move_construct(&newdata[0], &data[0], len);
-            destroy(&data[0], len);
-            deallocate(data, cap);
+            relocate(&newdata[0], &data[0], len);
+            FreeData();
             construct(&newdata[len], newlen-len, value);
             data = newdata;
             len  = newlen;
@@ -523,6 +599,23 @@ public:
 
     void swap(VecType& b)
     {
+      #ifdef VecInlineCapacity
+        if(data == local || b.data == b.local)
+        {
+            // At least one of the two is stored inline.
+            // Exchange the inline parts by copying.
+            T tmp[VecInlineCapacity];
+            T * mydata = data, * bdata = b.data;
+            if(mydata == local) copy_construct(tmp, local, len);
+            if(bdata == b.local) { copy_construct(local, b.local, b.len); data = local; }
+            else data = bdata;
+            if(mydata == local) { copy_construct(b.local, tmp, len); b.data = b.local; }
+            else b.data = mydata;
+            {size_type l=b.len; b.len=len; len=l;}
+            {size_type l=b.cap; b.cap=cap; cap=l;}
+            return;
+        }
+      #endif
      /* std::swap(data, b.data);
         std::swap(len,  b.len);
         std::swap(cap,  b.cap);
@@ -535,13 +628,45 @@ public:
     int empty() const { return len==0; }
     void clear()
     {
+      #ifdef VecInlineCapacity
+        if(data == local) { destroy(&data[0], len); len = 0; return; }
+      #endif
+      #ifdef VecIntern
+        if(shared()) { VecIntern.Release(data); SetEmpty(); return; }
+      #endif
         if(!cap) return;
         destroy(&data[0], len);
-        len = 0;
-        deallocate(data, cap);
-        data = 0;
-        cap = 0;
-    }
+        FreeData();
+        SetEmpty();
+    }
+  #ifdef VecArena
+    /* Makes the vector empty without freeing anything.
+     * Only for use right before VecArena.ReleaseAll().
+     */
+    void forget()
+    {
+        SetEmpty();
+    }
+  #endif
+  #ifdef VecIntern
+    /* Makes this vector share its contents with other vectors that
+     * have the same contents, if they have also called intern().
+     */
+    void intern()
+    {
+        if(shared() || !len) return;
+      #ifdef VecInlineCapacity
+        if(data == local) return; // Nothing to gain
+      #endif
+        T * payload = (T *) VecIntern.Intern(data, len * sizeof(T));
+        if(!payload) return;
+        FreeData();
+        data = payload;
+        cap  = 0;
+    }
+    /* Whether the contents are shared (capacity() is then 0) */
+    int shared() const { return !cap && data; }
+  #endif
     size_type size()     const { return len; }
     size_type capacity() const { return cap; }
 
@@ -574,7 +699,10 @@ private:
     }
     static void destroy(T * target, size_type count)
     {
-      #if defined(__cplusplus) && __cplusplus >= 199700L
+      #if defined(TriviallyCopyable)
+        target=target;
+        count=count;
+      #elif defined(__cplusplus) && __cplusplus >= 199700L
         for(size_type a=count; a-- > 0; )
             target[a].~T();
       #elif defined(UsePlacementNew)
@@ -587,7 +715,9 @@ private:
     }
     static void move_assign(T * target, T * source, size_type count)
     {
-      #if defined(__cplusplus) && __cplusplus >= 201100L
+      #if defined(TriviallyCopyable)
+        if(count) memmove(target, source, count * sizeof(T));
+      #elif defined(__cplusplus) && __cplusplus >= 201100L
         for(size_type a=0; a<count; ++a)
             target[a] = std::move(source[a]);
       #elif defined(UsePlacementNew)
@@ -599,7 +729,9 @@ private:
     }
     static void move_assign_backwards(T * target, T * source, size_type count)
     {
-      #if defined(__cplusplus) && __cplusplus >= 201100L
+      #if defined(TriviallyCopyable)
+        if(count) memmove(target, source, count * sizeof(T));
+      #elif defined(__cplusplus) && __cplusplus >= 201100L
         for(size_type a=count; a-- > 0; )
             target[a] = std::move(source[a]);
       #elif defined(UsePlacementNew)
@@ -611,7 +743,9 @@ private:
     }
     static void move_construct(T * target, T * source, size_type count)
     {
-      #if defined(__cplusplus) && __cplusplus >= 201100L
+      #if defined(TriviallyCopyable)
+        if(count) memcpy(target, source, count * sizeof(T));
+      #elif defined(__cplusplus) && __cplusplus >= 201100L
         for(size_type a=0; a<count; ++a)
             new(&target[a]) T( std::move(source[a]) );
       #elif defined(UsePlacementNew)
@@ -627,20 +761,33 @@ private:
     static T const*
             copy_assign(T * target, T const* source, size_type count)
     {
+      #ifdef TriviallyCopyable
+        if(count) memcpy(target, source, count * sizeof(T));
+        return source + count;
+      #else
         for(size_type a=0; a<count; ++a)
             target[a] = *source++;
         return source;
+      #endif
     }
     static T const*
             copy_assign_backwards(T * target, T const* source, size_type count)
     {
+      #ifdef TriviallyCopyable
+        if(count) memmove(target, source, count * sizeof(T));
+      #else
         for(size_type a=count; a-- > 0; )
             target[a] = source[a];
+      #endif
         return source;
     }
     static T const*
             copy_construct(T * target, T const* source, size_type count)
     {
+      #ifdef TriviallyCopyable
+        if(count) memcpy(target, source, count * sizeof(T));
+        return source + count;
+      #else
         for(size_type a=0; a<count; ++a)
         {
           #if defined(__cplusplus) && __cplusplus >= 199700L
@@ -651,8 +798,22 @@ private:
             target[a] = *source++;
           #endif
         }
+      #endif
         return source;
     }
+    /* Move count elements from source into uninitialized memory at target.
+     * Afterwards, the source is considered uninitialized.
+     * With a bitwise-movable T, the ranges may overlap.
+     */
+    static void relocate(T * target, T * source, size_type count)
+    {
+      #ifdef VecBitwiseMove
+        if(count) memmove(target, source, count * sizeof(T));
+      #else
+        move_construct(target, source, count);
+        destroy(source, count);
+      #endif
+    }
 
     static size_t default_size()
     {
@@ -662,19 +823,90 @@ private:
 private:
     static T * allocate(size_type n)
     {
+      #ifdef VecArena
+        return (T *) VecArena.Allocate( n * sizeof(T) );
+      #else
         return (T *) malloc( n * sizeof(T) );
+      #endif
     }
     static void deallocate(T * p, size_type n)
     {
+      #ifdef VecArena
+        VecArena.Deallocate( (void*) p, n * sizeof(T) );
+      #else
         free( (void*) p );
         n=n;
+      #endif
+    }
+
+    void SetEmpty()
+    {
+      #ifdef VecInlineCapacity
+        data = local;
+        cap  = VecInlineCapacity;
+      #else
+        data = 0;
+        cap  = 0;
+      #endif
+        len  = 0;
+    }
+    void FreeData()
+    {
+      #ifdef VecInlineCapacity
+        if(data == local) return;
+      #endif
+        deallocate(data, cap);
+    }
+    void CopyFrom(const VecType& b)
+    {
+        // Assumes this vector is empty
+      #ifdef VecIntern
+        if(b.shared())
+        {
+            data = b.data;
+            len  = b.len;
+            cap  = 0;
+            VecIntern.AddRef(data);
+            return;
+        }
+      #endif
+        if(b.len > cap)
+        {
+            data = allocate(cap = b.len);
+            if(!data) fprintf(stdout, "VecType: Failed to allocate %u bytes\n", (unsigned)b.len);
+        }
+        copy_construct(&data[0], &b.data[0], b.len);
+        len = b.len;
+    }
+
+  #ifdef VecIntern
+    /* Replaces the shared contents with a private copy */
+    void Unshare()
+    {
+        T * payload = data;
+        size_type n = len;
+        SetEmpty();
+        if(n > cap)
+        {
+            data = allocate(cap = n);
+            if(!data) fprintf(stdout, "VecType: Failed to allocate %u bytes\n", (unsigned)n);
+        }
+        copy_construct(&data[0], payload, n);
+        len = n;
+        VecIntern.Release(payload);
     }
+  #endif
 
 private:
     T * data;
-    size_type len, cap;
+    size_type len, cap;  // cap is 0 if the contents are shared (VecIntern)
+  #ifdef VecInlineCapacity
+    T local[VecInlineCapacity];
+  #endif
 
 #undef Ttype
+#undef VecBitwiseMove
+#undef VecOwn
     #undef q
 };
 